@@ -0,0 +1,174 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Walker's alias method over 24-bit integer weights summing to 2**24.
+ * Outcomes are padded with empty columns to a power of 2 count, so every
+ * column holds exactly 2**24 / columns weight units and the table reproduces
+ * the integer weights exactly: high bits of a draw select a column, low bits
+ * are compared with its threshold to pick the column's own outcome or its
+ * alias. A column is packed into 32 bits, alias index << 24 | threshold.
+ *
+ * Everything but aliasPick() is constexpr, so fixed tables are built and
+ * checked by the compiler.
+ */
+#define ALIAS_WEIGHT_BITS     24
+#define ALIAS_MAX_COLUMNS     32
+#define ALIAS_THRESHOLD_MASK  ( ( (uint32_t)1 << ALIAS_WEIGHT_BITS ) - 1 )
+
+
+// At least 2 columns, so a full column threshold fits 24 bits
+constexpr int aliasColumnBits( size_t count )
+{
+    int bits = 1;
+    while( ( (size_t)1 << bits ) < count )
+        ++bits;
+
+    return bits;
+}
+
+
+// Fills 1 << aliasColumnBits( count ) columns, count <= ALIAS_MAX_COLUMNS
+constexpr void buildAliasColumns( uint32_t *columns, const uint32_t *weights, size_t count )
+{
+    const size_t columnCount = (size_t)1 << aliasColumnBits( count );
+    const uint32_t capacity = (uint32_t)1 << ( ALIAS_WEIGHT_BITS - aliasColumnBits( count ) );
+
+    // Vose's construction: fill every underfull column from an overfull one
+    uint32_t left[ALIAS_MAX_COLUMNS] = {};
+    size_t small[ALIAS_MAX_COLUMNS] = {}, large[ALIAS_MAX_COLUMNS] = {};
+    size_t smallCount = 0, largeCount = 0;
+
+    for( size_t i = 0; i < columnCount; ++i )
+    {
+        left[i] = ( i < count ) ? weights[i] : 0;
+
+        if( left[i] < capacity )
+            small[smallCount++] = i;
+        else
+            large[largeCount++] = i;
+    }
+
+    while( smallCount > 0 && largeCount > 0 )
+    {
+        const size_t s = small[--smallCount];
+        const size_t l = large[--largeCount];
+
+        columns[s] = (uint32_t)l << ALIAS_WEIGHT_BITS | left[s];
+
+        left[l] -= capacity - left[s];
+        if( left[l] < capacity )
+            small[smallCount++] = l;
+        else
+            large[largeCount++] = l;
+    }
+
+    // With weights summing to 2**24 the rest are exactly full
+    while( largeCount > 0 )
+    {
+        const size_t l = large[--largeCount];
+        columns[l] = (uint32_t)l << ALIAS_WEIGHT_BITS | capacity;
+    }
+
+    while( smallCount > 0 )
+    {
+        const size_t s = small[--smallCount];
+        columns[s] = (uint32_t)s << ALIAS_WEIGHT_BITS | capacity;
+    }
+}
+
+
+// Every draw must land on a real outcome, and each outcome must get exactly its weight
+constexpr bool aliasColumnsExact( const uint32_t *columns, const uint32_t *weights, size_t count )
+{
+    const size_t columnCount = (size_t)1 << aliasColumnBits( count );
+    const uint32_t capacity = (uint32_t)1 << ( ALIAS_WEIGHT_BITS - aliasColumnBits( count ) );
+    uint32_t mass[ALIAS_MAX_COLUMNS] = {};
+
+    if( count > ALIAS_MAX_COLUMNS )
+        return false;
+
+    for( size_t i = 0; i < columnCount; ++i )
+    {
+        const uint32_t threshold = columns[i] & ALIAS_THRESHOLD_MASK;
+        const size_t alias = columns[i] >> ALIAS_WEIGHT_BITS;
+
+        if( threshold > capacity || ( i >= count && threshold != 0 ) )
+            return false;
+
+        if( threshold < capacity && alias >= count )
+            return false;
+
+        mass[i] += threshold;
+        mass[alias] += capacity - threshold;
+    }
+
+    for( size_t i = 0; i < count; ++i )
+        if( mass[i] != weights[i] )
+            return false;
+
+    return true;
+}
+
+
+// Weights reproduced by the columns, the inverse of buildAliasColumns()
+constexpr void aliasWeights( const uint32_t *columns, size_t count, uint32_t *weights )
+{
+    const size_t columnCount = (size_t)1 << aliasColumnBits( count );
+    const uint32_t capacity = (uint32_t)1 << ( ALIAS_WEIGHT_BITS - aliasColumnBits( count ) );
+
+    for( size_t i = 0; i < count; ++i )
+        weights[i] = 0;
+
+    for( size_t i = 0; i < columnCount; ++i )
+    {
+        const uint32_t threshold = columns[i] & ALIAS_THRESHOLD_MASK;
+        const size_t alias = columns[i] >> ALIAS_WEIGHT_BITS;
+
+        if( i < count )
+            weights[i] += threshold;
+
+        if( alias < count )
+            weights[alias] += capacity - threshold;
+    }
+}
+
+
+// Outcome of a 24-bit draw, shift is ALIAS_WEIGHT_BITS - aliasColumnBits( count )
+static inline size_t aliasPick( const uint32_t *columns, int shift, uint32_t draw )
+{
+    const size_t index = draw >> shift;
+    const uint32_t column = columns[index];
+
+    return ( ( draw & ( ( (uint32_t)1 << shift ) - 1 ) ) < ( column & ALIAS_THRESHOLD_MASK ) )
+           ? index : column >> ALIAS_WEIGHT_BITS;
+}
+
+#endif // ALIAS_TABLE_H
@@ -0,0 +1,152 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef BULK_GENERATOR_H
+#define BULK_GENERATOR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "KeyEncoder.h"
+#include "KeyedPermutation.h"
+#include "NameModel.h"
+#include "PasswordPolicy.h"
+#include "Wordlist.h"
+#include "UniqueFilter.h"
+
+#define BULK_CHUNK_ITEMS 16384
+
+#define PASSPHRASE_WORD_SEPARATOR '-'
+
+// Rejected items in a row meaning the output space is used up
+#define UNIQUE_SATURATION_STREAK ( 1 << 16 )
+
+
+enum RandomEntity { RE_UNKNOWN, RE_NAME, RE_PIN, RE_PASSWD, RE_BYTES, RE_PHRASE };
+
+
+struct GenerationJob
+{
+    RandomEntity entity;
+    long long count;
+    int minLength;
+    int maxLength;
+    KeyEncoding encoding;  // RE_BYTES output format
+    const PolicyTable *policy;  // RE_PASSWD rules and lengths, NULL for the plain password set
+    const Wordlist *wordlist;   // RE_PHRASE words, length is the word count
+    const NameModel *nameModel; // RE_NAME letter model, length in letters; NULL for syllable rules
+    UniqueFilter *unique;       // Drops repeated items and generates more, NULL to allow repeats
+    const KeyedPermutation *permutation;  // Fixed length RE_PIN or RE_BYTES: item i is permutation->map( i )
+    bool measure;               // RE_NAME: sum up information of every written name
+};
+
+
+/*
+ * Generates job.count newline-separated entities.
+ *
+ * Parallel mode splits the job into chunks of BULK_CHUNK_ITEMS entities.
+ * Every worker thread fills its own buffer with a whole chunk and writes it
+ * with a single write() call. Ordered mode writes chunks in their index
+ * order, unordered mode writes each chunk as soon as it is ready.
+ *
+ * With job.unique every chunk is filtered right before it is written, so
+ * in parallel mode the filter is used under the write lock only. Chunks
+ * are generated until job.count items are kept or the output space is
+ * used up, see isSaturated().
+ *
+ * In seeded mode chunk i is generated from stream i + 1, so ordered output
+ * is the same for any thread count.
+ *
+ * With job.permutation item i of the output is the i-th value of the
+ * permutation, so items never repeat and chunks need no filtering.
+ */
+class BulkGenerator
+{
+public:
+    BulkGenerator( const GenerationJob &job );
+
+    bool writeSerial( FILE *out );
+    bool writeParallel( int fd, int threadCount, bool ordered );
+
+    // Appends job.count items to dst in the calling thread, without unique mode.
+    // dst is grown once up front, so its earlier content is not copied around unwiped
+    bool append( std::string *dst );
+
+    bool isSaturated() const { return saturated; }
+
+    // Random bits drawn by all threads, rejected items included
+    uint64_t bitsDrawn() const { return drawnBits; }
+
+    // With job.measure: mean -log2 probability of the written names
+    double meanInformation() const { return ( measured > 0 ) ? informationSum / measured : 0; }
+
+    // Upper bound of one item of the job, '\n' included
+    static size_t itemCapacity( const GenerationJob &job );
+
+    // Grows dst to hold capacity bytes, wiping the buffer it leaves
+    static void reserveSecret( std::string *dst, size_t capacity );
+
+    // Entity named by a word as "PINs" or "nicknames", RE_UNKNOWN if none
+    static RandomEntity parseEntity( const char *name );
+
+    // Lengths when none are given, false for RE_UNKNOWN
+    static bool defaultLengths( RandomEntity entity, bool letterModel, int *minLength, int *maxLength );
+
+private:
+    bool generateChunk( std::string *chunk, std::vector<uint32_t> *offsets, long long first, long long items ) const;
+    void appendItem( std::string *dst ) const;
+    long long filterChunk( std::string *chunk, long long wanted );
+    void measureChunk( const std::string &chunk );
+    void worker();
+
+private:
+    GenerationJob job;
+
+    int outFd;
+    bool inOrder;
+    long long chunkCount;
+    std::atomic<long long> nextChunk;
+
+    std::mutex writeMutex;
+    std::condition_variable writeTurn;
+    long long nextToWrite;
+    bool failed;
+
+    long long kept;                  // Items written by the unique mode
+    long long rejectStreak;
+    std::atomic<bool> finished;
+    bool saturated;
+
+    std::atomic<uint64_t> drawnBits;
+    double informationSum;           // Written under the write lock
+    long long measured;
+
+};
+
+#endif // BULK_GENERATOR_H
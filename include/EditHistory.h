@@ -0,0 +1,79 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef EDIT_HISTORY_H
+#define EDIT_HISTORY_H
+
+#include <stddef.h>
+#include <deque>
+
+#include "StorageEngine.h"
+
+
+enum EditStepKind
+{
+    ESK_CHANGE_ROW = 0,
+    ESK_INSERT_ROW,
+    ESK_DELETE_ROW
+};
+
+
+/*
+ * Single undoable table change.
+ *
+ * Rows are identified by a stable id, so sorting the table does not
+ * invalidate the history. Row content is kept as DataRow, whose cells are
+ * implicitly shared QByteArrays: a step references the data of the affected
+ * row only, and untouched rows are never copied into the history.
+ */
+struct EditStep
+{
+    EditStepKind kind;
+    int rowId;
+    int row;         // Table position at the moment of the change
+    DataRow before;  // ESK_CHANGE_ROW, ESK_DELETE_ROW
+    DataRow after;   // ESK_CHANGE_ROW, ESK_INSERT_ROW
+};
+
+
+class EditHistory
+{
+public:
+    EditHistory( size_t maxDepth );
+
+    void push( const EditStep &step );
+    void clear();
+
+    // Returned step stays valid until the next history modification
+    const EditStep *undo();
+    const EditStep *redo();
+
+private:
+    std::deque<EditStep> undoSteps;
+    std::deque<EditStep> redoSteps;
+    size_t depthLimit;
+
+};
+
+#endif // EDIT_HISTORY_H
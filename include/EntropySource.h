@@ -0,0 +1,74 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ENTROPY_SOURCE_H
+#define ENTROPY_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum EntropyBackend
+{
+    EB_OPENSSL = 0,  // OpenSSL RAND_bytes()
+    EB_GETRANDOM,    // Kernel getrandom(), vDSO-accelerated by glibc 2.41+ on Linux 6.11+
+    EB_CHACHA20,     // Fast-key-erasure ChaCha20 DRBG seeded from the kernel
+    EB_COUNT
+};
+
+#define SEED_KEY_SIZE 32
+
+
+class EntropySource
+{
+public:
+    virtual ~EntropySource();
+
+    virtual bool fill( uint8_t *dst, size_t size ) = 0;
+
+    static EntropySource *create( EntropyBackend backend );
+
+    // Reproducible ChaCha20 stream of a SEED_KEY_SIZE byte key, never for secrets.
+    // Fails in a child process after fork(), which must create its own
+    static EntropySource *createSeeded( const uint8_t *seedKey, uint64_t stream );
+
+    static const char *backendName( EntropyBackend backend );
+    static bool parseBackend( const char *name, EntropyBackend *dst );
+
+    // Incremented in every child process after fork()
+    static unsigned forkGeneration() { return forkCounter; }
+
+protected:
+    EntropySource();
+
+private:
+    static void installForkHandler();
+    static void onForkChild();
+
+private:
+    static volatile unsigned forkCounter;
+
+};
+
+#endif // ENTROPY_SOURCE_H
@@ -0,0 +1,57 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KEY_ENCODER_H
+#define KEY_ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+enum KeyEncoding
+{
+    KE_HEX = 0,    // Lowercase, high nibble first
+    KE_BASE64,     // RFC 4648 section 4, padded with '='
+    KE_BASE64URL,  // RFC 4648 section 5, no padding
+    KE_BASE32,     // RFC 4648 section 6, padded with '='
+    KE_BASE58,     // Bitcoin alphabet, a leading zero byte is encoded as '1'
+    KE_COUNT
+};
+
+
+class KeyEncoder
+{
+public:
+    // Upper bound of encode() result, exact for every encoding but base58
+    static size_t encodedLength( KeyEncoding encoding, size_t bytes );
+
+    // Writes the text without terminating zero, returns its length
+    static size_t encode( KeyEncoding encoding, char *dst, const uint8_t *src, size_t bytes );
+
+    static const char *encodingName( KeyEncoding encoding );
+    static bool parseEncoding( const char *name, KeyEncoding *dst );
+
+};
+
+#endif // KEY_ENCODER_H
@@ -0,0 +1,83 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef KEYED_PERMUTATION_H
+#define KEYED_PERMUTATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "KeyEncoder.h"
+
+#define PERMUTATION_ROUNDS      10
+#define PERMUTATION_MAX_DIGITS  19   // 10^19 - 1 still fits uint64_t
+#define PERMUTATION_MAX_BYTES   8
+
+
+/*
+ * Randomly keyed bijection of [0, maxValue] onto itself.
+ *
+ * A balanced Feistel network with SipHash-2-4 rounds permutes the
+ * smallest even-width bit domain holding maxValue, and cycle walking
+ * maps the values above maxValue back into range. The domain is at most
+ * 4 times larger than the range, so a value needs under 4 walks on
+ * average. Mapping distinct indices gives distinct values with O(1)
+ * memory, and index ranges can be mapped by any number of threads.
+ */
+class KeyedPermutation
+{
+public:
+    // Draws a random key, returns NULL with errno set if it fails
+    static KeyedPermutation *create( uint64_t maxValue );
+    ~KeyedPermutation();
+
+    uint64_t maxValue() const { return lastValue; }
+    uint64_t map( uint64_t index ) const;  // index <= maxValue()
+
+    /*
+     * Items for indices [first, first + count): zero padded decimal values
+     * of <digits> written every <stride> bytes, or <bytes> long big-endian
+     * values encoded back to back like Randomizer::makeKeys().
+     */
+    size_t writePins( char *dst, size_t stride, int digits, uint64_t first, size_t count ) const;
+    size_t writeKeys( char *dst, size_t capacity, uint32_t *offsets, char separator,
+                      int bytes, KeyEncoding encoding, uint64_t first, size_t count ) const;
+
+    static uint64_t pinMaxValue( int digits );
+    static uint64_t keyMaxValue( int bytes );
+
+private:
+    KeyedPermutation( uint64_t maxValue );
+
+    uint64_t encrypt( uint64_t value ) const;
+
+private:
+    uint64_t lastValue;
+    int halfBits;
+    uint64_t halfMask;
+    uint64_t key[2];
+
+};
+
+#endif // KEYED_PERMUTATION_H
@@ -26,20 +26,27 @@
 #define MAIN_WINDOW_H
 
 #include <QtCore/QVector>
+#include <QtCore/QByteArray>
 #include <QtGui/QMainWindow>
 #include <QtGui/QPlainTextEdit>
 #include <QtGui/QTableWidget>
 #include <QtGui/QDialogButtonBox>
 
+#include "StorageEngine.h"
+#include "EditHistory.h"
+
 #define WINDOW_ICON_PATH "/home/crypton/progs/ds_passkeeper.svg"
 
-class StorageEngine;
+#define SORTABLE_COLUMNS_COUNT 2
 
 
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
 
+    friend class RowEditDelegate;
+    friend class PasswordDelegate;
+
 public:
     MainWindow( const QString &title, StorageEngine *storage );
 
@@ -49,6 +56,25 @@ private:
     void loadTableContent();
     bool save();
 
+    void markRowDirty( int row );
+    DataRow rowContent( int row ) const;
+
+    bool hasPassword( int row ) const;
+    QString passwordText( int row ) const;
+
+    QByteArray collationKey( int row, int column ) const;
+    void applyRowOrder( const QVector<int> &order );
+
+    void beginRowChange( int row );
+    void endRowChange();
+    void commitComment( int row );
+    void syncCommentEdit();
+
+    void setRowContent( int row, const DataRow &content );
+    void insertTableRow( int row, int rowId, const DataRow &content );
+    bool removeTableRow( int row );
+    void indexRows( int first );
+
 private slots:
     void closeButtonEvent( QAbstractButton *button );
     void filterTable( const QString &keyWord );
@@ -56,9 +82,14 @@ private slots:
     void editCellEvent( int row, int column );
     void changeCellEvent( int newRow, int newCol, int oldRow, int oldCol );
     void tableContextMenuEvent( const QPoint &pos );
+    void sortTable( int column );
 
     void deleteRow( bool = false );
     void randomizeCell( bool = false );
+    void revealPassword( bool = false );
+    void copyPassword( bool = false );
+    void undo( bool = false );
+    void redo( bool = false );
 
 private:
     StorageEngine *storageEngine;
@@ -66,9 +97,32 @@ private:
     QPlainTextEdit *commentEdit;
     QDialogButtonBox *closeButtonBox;
 
-    QVector<QString> commentStorage;
+    QVector<QByteArray> commentStorage; // Raw UTF-8, decoded for the current row only
+
+    // Engine entry backing each table row, data.end() for rows not saved yet
+    QVector<std::multiset<DataRow>::iterator> rowSources;
+    QVector<std::multiset<DataRow>::iterator> deletedSources;
+    std::set<int> dirtyRows;
+
+    int revealedRow;
+
+    // Locale collation keys per row, null ones are computed on the next sort
+    QVector<QByteArray> sortKeys[SORTABLE_COLUMNS_COUNT];
+    int sortColumn;
+    Qt::SortOrder sortOrder;
+
+    // Stable row identities for the undo history, independent of sorting
+    QVector<int> rowIds;
+    QVector<int> idRows;  // Current row of every identity, -1 once removed
+    int nextRowId;
+
+    EditHistory history;
+    int changingRow;
+    bool changingNewRow;
+    DataRow changingBefore;
     bool dataChanged;
     int curPassRandMode;
+    QByteArray passwordPolicySpec;  // Last custom policy, UTF-8
 
 };
 
@@ -0,0 +1,92 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef NAME_MODEL_H
+#define NAME_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "AliasTable.h"
+
+#define NAME_MODEL_MAX_ORDER 3
+
+#define NAME_MODEL_LETTERS   26                          // 'a'..'z'
+#define NAME_MODEL_END       NAME_MODEL_LETTERS          // Symbol ending a name
+#define NAME_MODEL_START     NAME_MODEL_LETTERS          // Context symbol before the first letter
+#define NAME_MODEL_SYMBOLS   ( NAME_MODEL_LETTERS + 1 )
+#define NAME_MODEL_SHIFT     ( ALIAS_WEIGHT_BITS - aliasColumnBits( NAME_MODEL_SYMBOLS ) )
+
+
+/*
+ * Order-k character Markov model for nicknames, an alternative to the
+ * syllable rules of Randomizer::makeName().
+ *
+ * A state is the last k letters of a name, the first ones padded with
+ * NAME_MODEL_START, as a base-27 number. Every state has an alias table over
+ * the 26 letters and NAME_MODEL_END, 32 packed columns in two cache lines,
+ * so a letter costs one 24-bit draw and one lookup. Tables are trained from
+ * a corpus by train() into a file, which open() memory-maps as is.
+ *
+ * File layout: 64-byte header, then states * ALIAS_MAX_COLUMNS uint32_t
+ * columns in native byte order.
+ */
+class NameModel
+{
+public:
+    // Returns NULL with errno set, EINVAL for a malformed file
+    static NameModel *open( const char *path );
+    ~NameModel();
+
+    // Every run of ASCII letters of the corpus is a training name
+    static bool train( const char *corpusPath, const char *modelPath, int order );
+
+    uint32_t states() const { return stateCount; }
+    uint32_t startState() const { return stateCount - 1; }
+
+    uint32_t nextState( uint32_t state, int letter ) const
+    {
+        return ( state * NAME_MODEL_SYMBOLS + letter ) % stateCount;
+    }
+
+    const uint32_t *columns( uint32_t state ) const
+    {
+        return tables + (size_t)state * ALIAS_MAX_COLUMNS;
+    }
+
+    // True if nothing but NAME_MODEL_END follows the state
+    bool endsOnly( uint32_t state ) const;
+
+private:
+    NameModel();
+
+private:
+    const void *mapping;
+    size_t mappingSize;
+    const uint32_t *tables;
+    uint32_t stateCount;
+
+};
+
+#endif // NAME_MODEL_H
@@ -0,0 +1,187 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PASSWORD_POLICY_H
+#define PASSWORD_POLICY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <openssl/bn.h>
+
+#define POLICY_MAX_LENGTH 64
+
+
+enum CharClass
+{
+    CC_UPPER = 0,
+    CC_LOWER,
+    CC_DIGIT,
+    CC_SYMBOL,
+    CC_COUNT
+};
+
+#define CC_MASK( charClass ) ( 1U << (charClass) )
+#define CC_ALL               ( CC_MASK( CC_COUNT ) - 1 )
+
+// Chars of the plain password set, split by class
+static constexpr const char *charClassSets[CC_COUNT] = {
+    "ACDEFGHJKLMNPQRSTUVWXYZ",
+    "abcdefghijkmnpqrstuvwxyz",
+    "0123456789",
+    "#*?:+=_"
+};
+
+
+/*
+ * Password rules of a service: allowed char classes, minimal count of chars
+ * of each class, chars to avoid and length range. Policies known in advance
+ * are constexpr and checked by the compiler, see presetPolicyTable().
+ */
+struct PasswordPolicy
+{
+    int minLength;
+    int maxLength;
+    unsigned classes;         // CC_MASK() of allowed classes
+    int required[CC_COUNT];   // Minimal count of chars of each class
+    const char *forbidden;    // Chars to avoid, may be NULL
+
+    // Count of chars of a class left after removing the forbidden ones
+    constexpr int classSize( int charClass ) const
+    {
+        int size = 0;
+
+        for( const char *c = charClassSets[charClass]; *c != '\0'; ++c )
+        {
+            bool allowed = true;
+
+            for( const char *f = forbidden; NULL != f && *f != '\0'; ++f )
+                if( *f == *c )
+                    allowed = false;
+
+            size += allowed;
+        }
+
+        return size;
+    }
+
+    constexpr bool isValid() const
+    {
+        if( minLength < 1 || minLength > maxLength || maxLength > POLICY_MAX_LENGTH )
+            return false;
+
+        int requiredTotal = 0;
+        bool anyClass = false;
+
+        for( int i = 0; i < CC_COUNT; ++i )
+        {
+            if( required[i] < 0 )
+                return false;
+
+            if( !( classes & CC_MASK( i ) ) || 0 == classSize( i ) )
+            {
+                if( required[i] > 0 )
+                    return false;
+
+                continue;
+            }
+
+            anyClass = true;
+            requiredTotal += required[i];
+        }
+
+        return anyClass && requiredTotal <= minLength;
+    }
+
+    /*
+     * Parses a preset name ("web", "alnum", "strong") or class letters
+     * u, l, d, s each with an optional minimal count, as "u1l1d2s", then
+     * an optional ':' and forbidden chars. Presets set lengths, otherwise
+     * they are left untouched. forbidden points into spec.
+     */
+    static bool parse( const char *spec, PasswordPolicy *dst );
+};
+
+
+static constexpr PasswordPolicy policyWeb = { 12, 12, CC_ALL, { 1, 1, 1, 1 }, NULL };
+static constexpr PasswordPolicy policyAlnum = { 16, 16, CC_MASK( CC_UPPER ) | CC_MASK( CC_LOWER ) | CC_MASK( CC_DIGIT ),
+                                                { 1, 1, 1, 0 }, NULL };
+static constexpr PasswordPolicy policyStrong = { 20, 20, CC_ALL, { 2, 2, 2, 2 }, NULL };
+
+
+/*
+ * Policy prepared for exactly uniform generation. For every allowed length
+ * it lists class compositions (count of chars of each class) meeting the
+ * policy, with a running total of the number of passwords over all of them.
+ * A password takes a composition weighted by its number of passwords, which
+ * also gives the length, a random order of the class slots and a char for
+ * each slot. So every password the policy allows is equally likely.
+ */
+class PolicyTable
+{
+    friend class Randomizer;
+
+public:
+    explicit PolicyTable( const PasswordPolicy &policy );
+    ~PolicyTable();
+
+    bool isValid() const;
+    int maxLength() const;
+
+private:
+    PolicyTable( const PolicyTable & );
+    PolicyTable &operator=( const PolicyTable & );
+
+    void addCompositions( int charClass, int left, uint8_t *counts );
+
+private:
+    struct LengthTable
+    {
+        int length;
+        size_t first;  // Index of the first composition of this length
+        size_t count;
+    };
+
+    PasswordPolicy rules;
+    std::string alphabets[CC_COUNT];
+    std::vector<LengthTable> lengths;
+    std::vector<uint8_t> compositions;  // CC_COUNT counts each
+    std::vector<BIGNUM*> bounds;        // Running total of passwords up to each composition, all lengths
+
+};
+
+
+// Table of a constexpr policy, checked at compile time and built on the first use
+template<const PasswordPolicy &Policy>
+const PolicyTable &presetPolicyTable()
+{
+    static_assert( Policy.isValid(), "Password policy preset cannot be satisfied" );
+
+    static const PolicyTable table( Policy );
+    return table;
+}
+
+#endif // PASSWORD_POLICY_H
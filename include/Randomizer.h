@@ -28,31 +28,155 @@
 #include <stdint.h>
 #include <string>
 
+#include "EntropySource.h"
+#include "KeyEncoder.h"
+#include "NameModel.h"
+#include "PasswordPolicy.h"
+#include "Wordlist.h"
+
+#define RANDOM_BUFFER_SIZE 4096
+
+// Upper bound of makeName() result length
+#define NAME_MAX_LENGTH( maxSyllables ) ( 6 * (maxSyllables) + 2 )
+
+// Upper bound of makePassphrase() result length
+#define PASSPHRASE_MAX_LENGTH( wordlist, words ) ( (words) * ( (wordlist).maxWordLength() + 1 ) )
+
 
 struct LitInfo;
+struct LitTable;
+
+
+enum NameLiteralSet { NLS_VOWELS = 0, NLS_CONSONANTS, NLS_WORD_ENDS, NLS_COUNT };
+
+
+// Entropy of a generator's output distribution, in bits
+struct OutputEntropy
+{
+    double shannonBits;
+    double minBits;
+    bool exact;          // False for upper bounds: entropy of the choices, some of which give equal items
+};
 
 
 class Randomizer
 {
+    friend class RandomizerTest;
+
 public:
-    static uint32_t makeNumber( uint32_t modulo );
+    static uint32_t makeBits( int count );
+    static uint32_t makeNumber( uint32_t modulo );  // Uniform in [0, modulo)
+    static bool makeBytes( uint8_t *dst, size_t count );
 
     static std::string makePin( int length );
     static std::string makePassword( int length );
+    static std::string makePassword( const PolicyTable &policy );  // Uniform over all passwords the policy allows
     static std::string makeHexBlock( int bytes );
+    static std::string makeKey( int bytes, KeyEncoding encoding );
     static std::string makeName( int minSyllables, int maxSyllables );
+    static std::string makeName( const NameModel &model, int minLength, int maxLength );
+    static std::string makePassphrase( const Wordlist &wordlist, int words, char wordSeparator );
+
+    /*
+     * Batch generation without per-item allocations. Fixed-length items are
+     * written every <stride> bytes of dst (stride >= item length), bytes between
+     * the items are left untouched. Names and keys are written back to back,
+     * each one followed by separator: item i starts at offsets[i], offsets[count]
+     * is the end of data. Returns the number of complete items.
+     */
+    static size_t makePins( char *dst, size_t stride, int length, size_t count );
+    static size_t makePasswords( char *dst, size_t stride, int length, size_t count );
+    static size_t makeNames( char *dst, size_t capacity, uint32_t *offsets, char separator,
+                             int minSyllables, int maxSyllables, size_t count );
+    static size_t makeNames( char *dst, size_t capacity, uint32_t *offsets, char separator,
+                             const NameModel &model, int minLength, int maxLength, size_t count );
+    static size_t makeKeys( char *dst, size_t capacity, uint32_t *offsets, char separator,
+                            int bytes, KeyEncoding encoding, size_t count );
+    static size_t makePassphrases( char *dst, size_t capacity, uint32_t *offsets, char separator,
+                                   const Wordlist &wordlist, int words, char wordSeparator, size_t count );
+
+    // Random bits handed out by the calling thread's generator so far
+    static uint64_t bitsDrawn();
+
+    /*
+     * Entropy accounting. Bits drawn say what an item cost, the output
+     * entropy says how hard it is to guess: lengths are uniform in the given
+     * range, as BulkGenerator picks them. Information of a single name is
+     * -log2 of its probability, summed over every way to generate it, or
+     * INFINITY if it cannot be generated.
+     */
+    static OutputEntropy pinEntropy( int minLength, int maxLength );
+    static OutputEntropy passwordEntropy( int minLength, int maxLength );
+    static OutputEntropy passwordEntropy( const PolicyTable &policy );
+    static OutputEntropy keyEntropy( int minBytes, int maxBytes );
+    static OutputEntropy passphraseEntropy( const Wordlist &wordlist, int minWords, int maxWords );
+    static OutputEntropy nameEntropy( int minSyllables, int maxSyllables );
+    static OutputEntropy nameEntropy( const NameModel &model, int minLength, int maxLength );
+    static double nameInformation( const char *name, size_t length, int minSyllables, int maxSyllables );
+    static double nameInformation( const NameModel &model, const char *name, size_t length, int minLength, int maxLength );
+
+    // Name literal tables for self-tests: values, weights out of 2**24 and counts of real draws
+    static size_t literalCount( NameLiteralSet set );
+    static const char *literalValue( NameLiteralSet set, size_t index );
+    static uint32_t literalWeight( NameLiteralSet set, size_t index );
+    static bool countLiterals( NameLiteralSet set, uint64_t *counts, size_t draws );
+
+    // Applies to the calling thread and to threads which have not generated anything yet
+    static bool setBackend( EntropyBackend backend );
+
+    /*
+     * Deterministic mode for benchmarks and test fixtures, NEVER for secrets.
+     * All output comes from ChaCha20 keyed by SHA-256 of the seed. Every
+     * thread starts on stream 0, selectStream() restarts the calling thread
+     * on another one, so work split by a stream number gives the same items
+     * with any thread count. Must be set before generating threads start,
+     * and cannot be left.
+     */
+    static bool setSeed( const void *seed, size_t size );
+    static bool isSeeded();
+    static bool selectStream( uint64_t stream );  // False and no effect unless seeded
 
 private:
     Randomizer();
+    ~Randomizer();
+
+    // Write a single item, return count of chars written
+    int writePin( char *dst, int length );
+    int writePassword( char *dst, int length );
+    int writePassword( char *dst, const PolicyTable &policy );
+    size_t writeKey( char *dst, int bytes, KeyEncoding encoding );
+    int writeName( char *dst, int minSyllables, int maxSyllables );
+    int writeName( char *dst, const NameModel &model, int minLength, int maxLength );
+    size_t writePassphrase( char *dst, const Wordlist &wordlist, int words, char wordSeparator );
+
+    void replaceSource( EntropySource *newSource );
 
+    bool getUniform( uint32_t *dst, uint32_t modulo );
+    bool getUniform( BIGNUM *dst, const BIGNUM *modulo );
     bool getBits( uint32_t *dst, int count );
-    const LitInfo *getLiteral( const LitInfo *stBegin, size_t stSizeBytes );
+    bool unreadReservoir();
+    bool getBytes( uint8_t *dst, size_t count );
+    const LitInfo *getLiteral( const LitTable *table );
 
     static Randomizer *getInstance();
 
 private:
-    uint32_t pool[8];
-    int poolSize;
+    uint64_t reservoir;  // Unused random bits, LSB first; bits above reservoirBits are zero
+    int reservoirBits;
+    uint64_t drawnBits;
+
+    // getUniform() word width and rejection threshold, most recent modulo first
+    struct UniformRange
+    {
+        uint32_t modulo;
+        int bits;
+        uint64_t threshold;
+    } uniformRanges[2];
+
+    EntropySource *source;
+    uint8_t buffer[RANDOM_BUFFER_SIZE];
+    size_t bufferUsed;
+    unsigned bufferGeneration;
 
 };
 
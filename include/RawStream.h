@@ -0,0 +1,54 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RAW_STREAM_H
+#define RAW_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAW_BLOCK_SIZE ( 1 << 20 )
+#define RAW_SEEDED_STREAM_BYTES 4096  // Seeded mode output bytes per stream
+
+
+/*
+ * Streams raw random bytes to a file descriptor.
+ *
+ * Output goes in page-aligned blocks of RAW_BLOCK_SIZE, each filled in
+ * place by threadCount threads, every thread drawing its slice from its
+ * own entropy source. A pipe is grown to the block size and fed with
+ * vmsplice(), so the reader gets the pages without a copy; other outputs
+ * get a write() per block.
+ */
+class RawStream
+{
+public:
+    static bool write( int fd, uint64_t bytes, int threadCount );
+
+    // Writes all of data, retrying short and interrupted writes
+    static bool writeAll( int fd, const void *data, size_t size );
+
+};
+
+#endif // RAW_STREAM_H
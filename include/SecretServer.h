@@ -0,0 +1,106 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SECRET_SERVER_H
+#define SECRET_SERVER_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+
+#include "BulkGenerator.h"
+#include "PasswordPolicy.h"
+
+#define SERVE_POOL_ITEMS    4096        // Items kept ready for every kind of request
+#define SERVE_MAX_POOLS     64          // Kinds of requests, entity and length range
+#define SERVE_MAX_COUNT     65536       // Items per request
+#define SERVE_MAX_LENGTH    256
+#define SERVE_LINE_MAX      256
+#define SERVE_REPLY_FLUSH   ( 1 << 20 ) // Pipelined replies are written once this size is reached
+
+
+/*
+ * Answers requests for secrets on a Unix stream socket.
+ *
+ * A request is a line "<count> <entity> [length]" as on the command line,
+ * the reply is "OK <count>" and the items, a line each, or "ERR <reason>".
+ * A client may send any number of requests without waiting: all lines
+ * read at once are answered in order with a single write.
+ *
+ * Every kind of request gets a pool of SERVE_POOL_ITEMS items, refilled
+ * ahead by a background thread. An item leaves the pool at most once and
+ * its bytes are wiped right away; a request the pool cannot cover is
+ * finished in the connection thread. Connections get a thread each.
+ */
+class SecretServer
+{
+public:
+    // defaults: encoding, word list and name model of all requests; policy: NULL for plain passwords
+    SecretServer( const GenerationJob &defaults, const PasswordPolicy *policy );
+    ~SecretServer();
+
+    // Serves until SIGINT or SIGTERM, false and errno if the socket fails
+    bool serve( const char *path );
+
+private:
+    SecretServer( const SecretServer & );
+    SecretServer &operator=( const SecretServer & );
+
+    struct Pool
+    {
+        RandomEntity entity;
+        int minLength;
+        int maxLength;
+        PolicyTable *policy;
+        std::string items;  // Newline-terminated, served ones are wiped
+        size_t head;        // Offset of the first unserved item
+        size_t ready;
+    };
+
+    void connectionLoop( int fd );
+    void refillLoop();
+    void answer( const std::string &line, std::string *reply );
+    Pool *findPool( RandomEntity entity, int minLength, int maxLength, const char **error );
+    bool take( Pool *pool, long long count, std::string *reply );
+    bool generate( const Pool *pool, long long count, std::string *dst ) const;
+    GenerationJob poolJob( const Pool *pool, long long count ) const;
+
+private:
+    GenerationJob defaults;
+    PasswordPolicy rules;
+    bool havePolicy;
+
+    std::mutex lock;
+    std::condition_variable refillWanted;
+    std::condition_variable connectionClosed;
+    std::vector<Pool*> pools;
+    std::set<int> connections;
+    bool refillPending;
+    bool stopping;
+
+};
+
+#endif // SECRET_SERVER_H
@@ -0,0 +1,84 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SELF_TEST_H
+#define SELF_TEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define SELFTEST_DEFAULT_SAMPLES  ( 1LL << 24 )
+#define SELFTEST_CHUNK_ITEMS      16384
+#define SELFTEST_FAIL_P           1e-6    // Either tail, too good a fit fails as well
+
+
+/*
+ * Statistical self-test of the generators.
+ *
+ * Every test streams its samples through counters only, split into
+ * chunks taken by worker threads, each with its own Randomizer. Fixed
+ * alphabets get chi-square tests of every position and of all positions
+ * together and a serial correlation test of consecutive symbols. Names
+ * are checked against the LitInfo weights: each literal table by itself,
+ * and the first letter of whole names.
+ */
+class SelfTest
+{
+public:
+    SelfTest( long long samples, int threadCount );
+
+    // Prints a line per test, returns false if any of them failed
+    bool run( FILE *out );
+
+private:
+    struct Symbols;
+
+    struct Result
+    {
+        std::string name;
+        std::string statistic;
+        double p;         // Both tails are failures for chi-square
+    };
+
+    void testAlphabet( const char *name, int entity, int length, const std::string &alphabet );
+    void testNames();
+    void testLiterals();
+
+    template<class Work, class State>
+    bool runChunks( long long items, Work work, std::vector<State> *states );
+
+    void addChiSquare( const std::string &name, const uint64_t *counts, const double *expected, size_t cells );
+    void addResult( const std::string &name, const std::string &statistic, double p );
+
+private:
+    long long samples;
+    int threads;
+    std::vector<Result> results;
+    bool failed;
+
+};
+
+#endif // SELF_TEST_H
@@ -41,6 +41,7 @@ public:
     size_t encode( uint8_t *dst, size_t maxSize ) const;
 
     bool operator < ( const DataRow &other ) const;
+    bool operator == ( const DataRow &other ) const;
 
 public:
     QByteArray cells[DATA_COLS_COUNT];
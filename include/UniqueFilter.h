@@ -0,0 +1,85 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef UNIQUE_FILTER_H
+#define UNIQUE_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define UNIQUE_FILTER_MAX_BYTES  ( 64 << 20 )
+#define UNIQUE_FILTER_ITEM_BITS  10          // About 1% false positives at the planned count
+#define UNIQUE_FILTER_HASHES     7
+
+
+/*
+ * Rejects repeated items of a generated stream.
+ *
+ * A Bloom filter of bounded size answers "surely new" for most new items.
+ * Only its hits are confirmed against the exact set, a hash index over
+ * an arena holding every accepted item. The filter memory does not grow
+ * past UNIQUE_FILTER_MAX_BYTES. The exact set grows with the output, and
+ * more of its lookups are needed once the filter fills up.
+ */
+class UniqueFilter
+{
+public:
+    explicit UniqueFilter( long long plannedItems );
+    ~UniqueFilter();
+
+    // True for an item not seen before, which is remembered
+    bool insert( const char *item, size_t length );
+
+    long long acceptedCount() const { return accepted; }
+    long long rejectedCount() const { return rejected; }
+    long long filterHitCount() const { return filterHits; }  // Lookups which needed the exact set
+
+    /*
+     * Size of a uniform space giving as many repeats in as many draws, in
+     * bits. Without repeats only a lower bound is known, see isLowerBound.
+     */
+    double effectiveEntropyBits( bool *isLowerBound ) const;
+
+private:
+    bool findExact( uint64_t hash, const char *item, size_t length ) const;
+    void addExact( uint64_t hash, const char *item, size_t length );
+    void growIndex();
+
+private:
+    std::vector<uint64_t> bloom;
+    uint64_t bloomMask;            // Bit count - 1, a power of 2
+
+    std::vector<char> arena;       // uint32_t length and chars of every accepted item
+    std::vector<uint64_t> index;   // Arena offset + 1 per slot, 0 for empty
+    std::vector<uint32_t> tags;    // High hash bits per slot to skip most arena reads
+    size_t indexUsed;
+
+    long long accepted;
+    long long rejected;
+    long long filterHits;
+
+};
+
+#endif // UNIQUE_FILTER_H
@@ -0,0 +1,78 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WORDLIST_H
+#define WORDLIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define WORDLIST_MAX_WORD 64
+
+
+/*
+ * Read-only word list for passphrases, memory-mapped and indexed once.
+ * Accepts the EFF large list format, "<dice digits><tab><word>" per line,
+ * and plain lists of one word per line.
+ */
+class Wordlist
+{
+public:
+    // Returns NULL with errno set, EINVAL for a file without valid words
+    static Wordlist *open( const char *path );
+    ~Wordlist();
+
+    size_t size() const { return words.size(); }
+    size_t maxWordLength() const { return longest; }
+
+    const char *word( size_t index, size_t *length ) const
+    {
+        *length = words[index].length;
+        return data + words[index].offset;
+    }
+
+    // Strength of a passphrase of wordCount words
+    double entropyBits( int wordCount ) const;
+
+private:
+    Wordlist();
+
+    bool index();
+
+private:
+    struct WordRef
+    {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    const char *data;
+    size_t dataSize;
+    std::vector<WordRef> words;
+    size_t longest;
+
+};
+
+#endif // WORDLIST_H
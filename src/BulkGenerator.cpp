@@ -0,0 +1,474 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "BulkGenerator.h"
+#include "Randomizer.h"
+#include "RawStream.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+
+BulkGenerator::BulkGenerator( const GenerationJob &generationJob )
+: job( generationJob )
+, outFd( -1 )
+, inOrder( true )
+, chunkCount( 0 )
+, nextChunk( 0 )
+, nextToWrite( 0 )
+, failed( false )
+, kept( 0 )
+, rejectStreak( 0 )
+, finished( false )
+, saturated( false )
+, drawnBits( 0 )
+, informationSum( 0 )
+, measured( 0 )
+{
+}
+
+
+bool BulkGenerator::writeSerial( FILE *out )
+{
+    std::string chunk;
+    std::vector<uint32_t> offsets;
+    bool ok = true;
+
+    kept = 0;
+    rejectStreak = 0;
+    saturated = false;
+    drawnBits = 0;
+    informationSum = 0;
+    measured = 0;
+
+    for( long long index = 0; ok && ( ( NULL != job.unique ) ? kept : index * BULK_CHUNK_ITEMS ) < job.count; ++index )
+    {
+        // Chunks are sized as in worker() so -j does not change the output
+        const long long items = ( NULL != job.unique )
+            ? std::min( (long long)BULK_CHUNK_ITEMS, job.count )
+            : std::min( (long long)BULK_CHUNK_ITEMS, job.count - index * BULK_CHUNK_ITEMS );
+
+        Randomizer::selectStream( index + 1 );
+
+        const uint64_t drawnBefore = Randomizer::bitsDrawn();
+        ok = generateChunk( &chunk, &offsets, index * BULK_CHUNK_ITEMS, items );
+        drawnBits += Randomizer::bitsDrawn() - drawnBefore;
+
+        if( ok && NULL != job.unique )
+            filterChunk( &chunk, job.count - kept );
+
+        if( ok && job.measure )
+            measureChunk( chunk );
+
+        ok = ok && fwrite( chunk.data(), 1, chunk.size(), out ) == chunk.size() && !saturated;
+    }
+
+    std::fill( chunk.begin(), chunk.end(), 0 );
+    return ( fflush( out ) == 0 ) && ok;
+}
+
+
+bool BulkGenerator::writeParallel( int fd, int threadCount, bool ordered )
+{
+    outFd = fd;
+    inOrder = ordered;
+    chunkCount = ( job.count + BULK_CHUNK_ITEMS - 1 ) / BULK_CHUNK_ITEMS;
+    nextChunk = 0;
+    nextToWrite = 0;
+    failed = false;
+    kept = 0;
+    rejectStreak = 0;
+    finished = false;
+    saturated = false;
+    drawnBits = 0;
+    informationSum = 0;
+    measured = 0;
+
+    std::vector<std::thread> workers;
+    for( int i = 0; i < threadCount; ++i )
+        workers.push_back( std::thread( &BulkGenerator::worker, this ) );
+
+    for( size_t i = 0; i < workers.size(); ++i )
+        workers[i].join();
+
+    return !failed;
+}
+
+
+bool BulkGenerator::append( std::string *dst )
+{
+    std::string chunk;
+    std::vector<uint32_t> offsets;
+    bool ok = true;
+
+    reserveSecret( dst, dst->size() + job.count * itemCapacity( job ) );
+
+    for( long long first = 0; ok && first < job.count; first += BULK_CHUNK_ITEMS )
+    {
+        ok = generateChunk( &chunk, &offsets, first, std::min( (long long)BULK_CHUNK_ITEMS, job.count - first ) );
+        dst->append( chunk );
+    }
+
+    std::fill( chunk.begin(), chunk.end(), 0 );
+    return ok;
+}
+
+
+size_t BulkGenerator::itemCapacity( const GenerationJob &job )
+{
+    size_t length;
+
+    switch( job.entity )
+    {
+        case RE_NAME:
+                length = ( NULL != job.nameModel ) ? job.maxLength : NAME_MAX_LENGTH( job.maxLength );
+            break;
+
+        case RE_PASSWD:
+                length = ( NULL != job.policy ) ? job.policy->maxLength() : job.maxLength;
+            break;
+
+        case RE_BYTES:
+                length = KeyEncoder::encodedLength( job.encoding, job.maxLength );
+            break;
+
+        case RE_PHRASE:
+                length = PASSPHRASE_MAX_LENGTH( *job.wordlist, job.maxLength );
+            break;
+
+        default:
+                length = job.maxLength;
+            break;
+    }
+
+    return length + 1;
+}
+
+
+void BulkGenerator::reserveSecret( std::string *dst, size_t capacity )
+{
+    if( dst->capacity() >= capacity )
+        return;
+
+    std::string grown;
+    grown.reserve( capacity );
+    grown.append( *dst );
+
+    // The old buffer is released by the swap, wiped
+    std::fill( dst->begin(), dst->end(), 0 );
+    dst->swap( grown );
+}
+
+
+RandomEntity BulkGenerator::parseEntity( const char *name )
+{
+    std::string command( name );
+    std::transform( command.begin(), command.end(), command.begin(), (int(*)(int))tolower );
+
+    if( command.find( "name" ) != std::string::npos ) return RE_NAME;
+    if( command.find( "pin" ) != std::string::npos )  return RE_PIN;
+    if( command.find( "phrase" ) != std::string::npos ) return RE_PHRASE;
+    if( command.find( "pass" ) != std::string::npos ) return RE_PASSWD;
+    if( command.find( "byte" ) != std::string::npos ) return RE_BYTES;
+
+    return RE_UNKNOWN;
+}
+
+
+bool BulkGenerator::defaultLengths( RandomEntity entity, bool letterModel, int *minLength, int *maxLength )
+{
+    switch( entity )
+    {
+        case RE_NAME:
+                *minLength = letterModel ? 5 : 2;
+                *maxLength = letterModel ? 10 : 5;
+            break;
+
+        case RE_PIN:
+                *minLength = *maxLength = 4;
+            break;
+
+        case RE_PASSWD:
+                *minLength = *maxLength = 12;
+            break;
+
+        case RE_BYTES:
+                *minLength = *maxLength = 16;
+            break;
+
+        case RE_PHRASE:
+                *minLength = *maxLength = 6;
+            break;
+
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+
+bool BulkGenerator::generateChunk( std::string *chunk, std::vector<uint32_t> *offsets, long long first, long long items ) const
+{
+    if( NULL != job.permutation && RE_PIN == job.entity )
+    {
+        const size_t stride = job.minLength + 1;
+
+        chunk->assign( items * stride, '\n' );
+        job.permutation->writePins( &(*chunk)[0], stride, job.minLength, first, items );
+
+        return true;
+    }
+
+    if( NULL != job.permutation && RE_BYTES == job.entity )
+    {
+        chunk->resize( items * ( KeyEncoder::encodedLength( job.encoding, job.minLength ) + 1 ) );
+        offsets->resize( items + 1 );
+
+        const size_t generated = job.permutation->writeKeys( &(*chunk)[0], chunk->size(), &(*offsets)[0], '\n',
+                                                             job.minLength, job.encoding, first, items );
+        chunk->resize( (*offsets)[generated] );
+
+        return ( (long long)generated == items );
+    }
+
+    if( RE_NAME == job.entity )
+    {
+        chunk->resize( items * ( ( ( NULL != job.nameModel ) ? job.maxLength : NAME_MAX_LENGTH( job.maxLength ) ) + 1 ) );
+        offsets->resize( items + 1 );
+
+        const size_t generated = ( NULL != job.nameModel )
+            ? Randomizer::makeNames( &(*chunk)[0], chunk->size(), &(*offsets)[0], '\n',
+                                     *job.nameModel, job.minLength, job.maxLength, items )
+            : Randomizer::makeNames( &(*chunk)[0], chunk->size(), &(*offsets)[0], '\n',
+                                     job.minLength, job.maxLength, items );
+        chunk->resize( (*offsets)[generated] );
+
+        return ( (long long)generated == items );
+    }
+
+    if( RE_PHRASE == job.entity && job.minLength == job.maxLength )
+    {
+        chunk->resize( items * ( PASSPHRASE_MAX_LENGTH( *job.wordlist, job.minLength ) + 1 ) );
+        offsets->resize( items + 1 );
+
+        const size_t generated = Randomizer::makePassphrases( &(*chunk)[0], chunk->size(), &(*offsets)[0], '\n',
+                                                              *job.wordlist, job.minLength, PASSPHRASE_WORD_SEPARATOR,
+                                                              items );
+        chunk->resize( (*offsets)[generated] );
+
+        return ( (long long)generated == items );
+    }
+
+    if( RE_BYTES == job.entity && job.minLength == job.maxLength )
+    {
+        chunk->resize( items * ( KeyEncoder::encodedLength( job.encoding, job.minLength ) + 1 ) );
+        offsets->resize( items + 1 );
+
+        const size_t generated = Randomizer::makeKeys( &(*chunk)[0], chunk->size(), &(*offsets)[0], '\n',
+                                                       job.minLength, job.encoding, items );
+        chunk->resize( (*offsets)[generated] );
+
+        return ( (long long)generated == items );
+    }
+
+    if( job.minLength == job.maxLength && NULL == job.policy )
+    {
+        // Fixed length items are generated in place, separators are preset
+        const size_t stride = job.minLength + 1;
+        size_t generated = 0;
+
+        chunk->assign( items * stride, '\n' );
+
+        switch( job.entity )
+        {
+            case RE_PIN:    generated = Randomizer::makePins( &(*chunk)[0], stride, job.minLength, items );      break;
+            case RE_PASSWD: generated = Randomizer::makePasswords( &(*chunk)[0], stride, job.minLength, items ); break;
+            default:        break;
+        }
+
+        chunk->resize( generated * stride );
+        return ( (long long)generated == items );
+    }
+
+    reserveSecret( chunk, items * itemCapacity( job ) );
+    chunk->clear();
+
+    for( long long i = 0; i < items; ++i )
+        appendItem( chunk );
+
+    return true;
+}
+
+
+void BulkGenerator::appendItem( std::string *dst ) const
+{
+    if( RE_PASSWD == job.entity && NULL != job.policy )
+    {
+        dst->append( Randomizer::makePassword( *job.policy ) );
+        dst->push_back( '\n' );
+        return;
+    }
+
+    int curLength = job.minLength;
+
+    if( curLength < job.maxLength )
+        curLength += Randomizer::makeNumber( job.maxLength - curLength + 1 );
+
+    switch( job.entity )
+    {
+        case RE_PIN:    dst->append( Randomizer::makePin( curLength ) );      break;
+        case RE_PASSWD: dst->append( Randomizer::makePassword( curLength ) ); break;
+        case RE_BYTES:  dst->append( Randomizer::makeKey( curLength, job.encoding ) ); break;
+        case RE_PHRASE: dst->append( Randomizer::makePassphrase( *job.wordlist, curLength, PASSPHRASE_WORD_SEPARATOR ) ); break;
+        default:        break;
+    }
+
+    dst->push_back( '\n' );
+}
+
+
+long long BulkGenerator::filterChunk( std::string *chunk, long long wanted )
+{
+    // Items are compacted in place, each one keeps its '\n'
+    size_t read = 0, written = 0;
+    long long count = 0;
+
+    while( read < chunk->size() && count < wanted )
+    {
+        const size_t end = chunk->find( '\n', read );
+        const size_t length = ( std::string::npos == end ) ? chunk->size() - read : end - read;
+
+        if( job.unique->insert( chunk->data() + read, length ) )
+        {
+            if( written != read )
+                memmove( &(*chunk)[written], &(*chunk)[read], length + 1 );
+
+            written += length + 1;
+            ++count;
+            rejectStreak = 0;
+        }
+        else if( ++rejectStreak >= UNIQUE_SATURATION_STREAK )
+        {
+            saturated = true;
+        }
+
+        read += length + 1;
+    }
+
+    std::fill( chunk->begin() + written, chunk->end(), 0 );
+    chunk->resize( written );
+
+    kept += count;
+    return count;
+}
+
+
+void BulkGenerator::measureChunk( const std::string &chunk )
+{
+    if( RE_NAME != job.entity )
+        return;
+
+    for( size_t start = 0; start < chunk.size(); )
+    {
+        size_t end = chunk.find( '\n', start );
+        if( std::string::npos == end )
+            end = chunk.size();
+
+        informationSum += ( NULL != job.nameModel )
+            ? Randomizer::nameInformation( *job.nameModel, chunk.data() + start, end - start, job.minLength, job.maxLength )
+            : Randomizer::nameInformation( chunk.data() + start, end - start, job.minLength, job.maxLength );
+        measured++;
+
+        start = end + 1;
+    }
+}
+
+
+void BulkGenerator::worker()
+{
+    std::string chunk;
+    std::vector<uint32_t> offsets;
+
+    while( true )
+    {
+        const long long index = nextChunk++;
+        if( ( NULL == job.unique && index >= chunkCount ) || finished )
+            break;
+
+        // Unique mode does not know its chunk count, every chunk may be the last one
+        const long long items = ( NULL != job.unique )
+            ? std::min( (long long)BULK_CHUNK_ITEMS, job.count )
+            : std::min( (long long)BULK_CHUNK_ITEMS, job.count - index * BULK_CHUNK_ITEMS );
+
+        Randomizer::selectStream( index + 1 );
+
+        const uint64_t drawnBefore = Randomizer::bitsDrawn();
+        const bool generated = generateChunk( &chunk, &offsets, index * BULK_CHUNK_ITEMS, items );
+        drawnBits += Randomizer::bitsDrawn() - drawnBefore;
+
+        std::unique_lock<std::mutex> lock( writeMutex );
+
+        if( !generated )
+            failed = true;
+
+        while( inOrder && nextToWrite != index && !failed && !finished )
+            writeTurn.wait( lock );
+
+        // Another chunk completed the unique output meanwhile
+        const bool late = finished;
+
+        if( !failed && !late && NULL != job.unique )
+        {
+            filterChunk( &chunk, job.count - kept );
+
+            if( kept >= job.count )
+                finished = true;
+        }
+
+        if( !failed && !late && job.measure )
+            measureChunk( chunk );
+
+        // Items kept before saturation are still written
+        if( !failed && !late && !RawStream::writeAll( outFd, chunk.data(), chunk.size() ) )
+            failed = true;
+
+        if( saturated )
+            failed = true;
+
+        nextToWrite++;
+        writeTurn.notify_all();
+
+        if( failed || finished )
+            break;
+    }
+
+    // Generated secrets should not stay in the released memory
+    std::fill( chunk.begin(), chunk.end(), 0 );
+}
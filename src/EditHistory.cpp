@@ -0,0 +1,72 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "EditHistory.h"
+
+
+EditHistory::EditHistory( size_t maxDepth )
+: depthLimit( maxDepth )
+{
+}
+
+
+void EditHistory::push( const EditStep &step )
+{
+    redoSteps.clear();
+    undoSteps.push_back( step );
+
+    if( undoSteps.size() > depthLimit )
+        undoSteps.pop_front();
+}
+
+
+void EditHistory::clear()
+{
+    undoSteps.clear();
+    redoSteps.clear();
+}
+
+
+const EditStep *EditHistory::undo()
+{
+    if( undoSteps.empty() )
+        return NULL;
+
+    redoSteps.push_back( undoSteps.back() );
+    undoSteps.pop_back();
+
+    return &redoSteps.back();
+}
+
+
+const EditStep *EditHistory::redo()
+{
+    if( redoSteps.empty() )
+        return NULL;
+
+    undoSteps.push_back( redoSteps.back() );
+    redoSteps.pop_back();
+
+    return &undoSteps.back();
+}
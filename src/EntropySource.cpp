@@ -0,0 +1,400 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "EntropySource.h"
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+
+#include <sys/random.h>
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+
+
+#define CHACHA_KEY_WORDS        8
+#define CHACHA_BLOCK_SIZE       64
+#define CHACHA_BATCH_BLOCKS     16
+#define CHACHA_RESEED_INTERVAL  (1ULL << 30)   // Output bytes between kernel reseeds
+
+static const char *backendNames[EB_COUNT] = { "openssl", "getrandom", "chacha20" };
+
+static pthread_once_t forkHandlerOnce = PTHREAD_ONCE_INIT;
+
+
+static bool kernelRandom( uint8_t *dst, size_t size )
+{
+    while( size > 0 )
+    {
+        const ssize_t received = getrandom( dst, size, 0 );
+        if( received < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+
+            return false;
+        }
+
+        dst += received;
+        size -= received;
+    }
+
+    return true;
+}
+
+
+class OpenSslSource : public EntropySource
+{
+public:
+    bool fill( uint8_t *dst, size_t size )
+    {
+        while( size > 0 )
+        {
+            const int chunk = ( size > INT_MAX ) ? INT_MAX : (int)size;
+            if( !RAND_bytes( dst, chunk ) )
+                return false;
+
+            dst += chunk;
+            size -= chunk;
+        }
+
+        return true;
+    }
+
+};
+
+
+class GetrandomSource : public EntropySource
+{
+public:
+    bool fill( uint8_t *dst, size_t size )
+    {
+        return kernelRandom( dst, size );
+    }
+
+};
+
+
+/*
+ * +----------------------------------------------+
+ * |       Fast-key-erasure ChaCha20 DRBG         |
+ * +----------------------------------------------+
+ *
+ * Every batch of ChaCha20 blocks is generated with the current key, then
+ * the first 32 bytes of the batch replace the key and are wiped. Output
+ * bytes are wiped from the batch as soon as they are handed out, so a
+ * memory dump never reveals past output.
+ *
+ * The key is mixed with fresh kernel randomness on first use, after
+ * CHACHA_RESEED_INTERVAL output bytes and in a child process after fork(),
+ * where the buffered part of the parent's batch is thrown away as well.
+ *
+ */
+
+#define ROTL32( v, n ) ( ((v) << (n)) | ((v) >> (32 - (n))) )
+
+#define QUARTER_ROUND( a, b, c, d ) \
+    a += b; d ^= a; d = ROTL32( d, 16 ); \
+    c += d; b ^= c; b = ROTL32( b, 12 ); \
+    a += b; d ^= a; d = ROTL32( d, 8 );  \
+    c += d; b ^= c; b = ROTL32( b, 7 );
+
+
+static inline uint32_t loadLE( const uint8_t *src )
+{
+    return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+
+static inline void storeLE( uint8_t *dst, uint32_t value )
+{
+    dst[0] = (uint8_t)value;
+    dst[1] = (uint8_t)(value >> 8);
+    dst[2] = (uint8_t)(value >> 16);
+    dst[3] = (uint8_t)(value >> 24);
+}
+
+
+static void chachaBlock( const uint32_t *key, uint64_t counter, uint64_t nonce, uint8_t *dst )
+{
+    // "expand 32-byte k", key, 64-bit block counter, 64-bit nonce
+    const uint32_t input[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        (uint32_t)counter, (uint32_t)( counter >> 32 ), (uint32_t)nonce, (uint32_t)( nonce >> 32 )
+    };
+
+    uint32_t x[16];
+    memcpy( x, input, sizeof(x) );
+
+    for( int i = 0; i < 10; ++i )
+    {
+        QUARTER_ROUND( x[0], x[4], x[8],  x[12] )
+        QUARTER_ROUND( x[1], x[5], x[9],  x[13] )
+        QUARTER_ROUND( x[2], x[6], x[10], x[14] )
+        QUARTER_ROUND( x[3], x[7], x[11], x[15] )
+        QUARTER_ROUND( x[0], x[5], x[10], x[15] )
+        QUARTER_ROUND( x[1], x[6], x[11], x[12] )
+        QUARTER_ROUND( x[2], x[7], x[8],  x[13] )
+        QUARTER_ROUND( x[3], x[4], x[9],  x[14] )
+    }
+
+    for( int i = 0; i < 16; ++i )
+        storeLE( dst + i * 4, x[i] + input[i] );
+
+    OPENSSL_cleanse( x, sizeof(x) );
+}
+
+
+class ChaChaSource : public EntropySource
+{
+public:
+    ChaChaSource()
+    : available( 0 )
+    , outputSinceReseed( 0 )
+    , seedGeneration( 0 )
+    , seeded( false )
+    {
+        memset( key, 0, sizeof(key) );
+        memset( batch, 0, sizeof(batch) );
+    }
+
+    ~ChaChaSource()
+    {
+        OPENSSL_cleanse( key, sizeof(key) );
+        OPENSSL_cleanse( batch, sizeof(batch) );
+    }
+
+    bool fill( uint8_t *dst, size_t size )
+    {
+        if( !seeded || seedGeneration != forkGeneration() || outputSinceReseed >= CHACHA_RESEED_INTERVAL )
+        {
+            if( !reseed() )
+                return false;
+        }
+
+        outputSinceReseed += size;
+
+        while( size > 0 )
+        {
+            if( 0 == available )
+                nextBatch();
+
+            const size_t chunk = ( size < available ) ? size : available;
+            uint8_t *src = batch + sizeof(batch) - available;
+
+            memcpy( dst, src, chunk );
+            memset( src, 0, chunk );
+
+            dst += chunk;
+            size -= chunk;
+            available -= chunk;
+        }
+
+        return true;
+    }
+
+private:
+    bool reseed()
+    {
+        uint32_t fresh[CHACHA_KEY_WORDS];
+        if( !kernelRandom( (uint8_t*)fresh, sizeof(fresh) ) )
+            return false;
+
+        for( int i = 0; i < CHACHA_KEY_WORDS; ++i )
+            key[i] ^= fresh[i];
+
+        OPENSSL_cleanse( fresh, sizeof(fresh) );
+        memset( batch, 0, sizeof(batch) );
+
+        available = 0;
+        outputSinceReseed = 0;
+        seedGeneration = forkGeneration();
+        seeded = true;
+
+        return true;
+    }
+
+    void nextBatch()
+    {
+        for( uint32_t counter = 0; counter < CHACHA_BATCH_BLOCKS; ++counter )
+            chachaBlock( key, counter, 0, batch + counter * CHACHA_BLOCK_SIZE );
+
+        // Fast key erasure: the key used for this batch is gone from now on
+        for( int i = 0; i < CHACHA_KEY_WORDS; ++i )
+            key[i] = loadLE( batch + i * 4 );
+
+        memset( batch, 0, sizeof(key) );
+        available = sizeof(batch) - sizeof(key);
+    }
+
+private:
+    uint32_t key[CHACHA_KEY_WORDS];
+    uint8_t batch[CHACHA_BATCH_BLOCKS * CHACHA_BLOCK_SIZE];
+    size_t available;
+    unsigned long long outputSinceReseed;
+    unsigned seedGeneration;
+    bool seeded;
+
+};
+
+
+/*
+ * Deterministic ChaCha20 in counter mode, for reproducible test data only.
+ * The key is fixed and the stream number is the nonce, so every stream
+ * of a seed is the same on every run and machine.
+ *
+ * A forked child would repeat the output its parent is about to produce,
+ * so the source fails there with ECHILD; the child creates its own stream.
+ */
+class SeededSource : public EntropySource
+{
+public:
+    SeededSource( const uint8_t *seedKey, uint64_t streamNumber )
+    : stream( streamNumber )
+    , counter( 0 )
+    , available( 0 )
+    , generation( forkGeneration() )
+    {
+        for( int i = 0; i < CHACHA_KEY_WORDS; ++i )
+            key[i] = loadLE( seedKey + i * 4 );
+
+        memset( block, 0, sizeof(block) );
+    }
+
+    ~SeededSource()
+    {
+        OPENSSL_cleanse( key, sizeof(key) );
+        OPENSSL_cleanse( block, sizeof(block) );
+    }
+
+    bool fill( uint8_t *dst, size_t size )
+    {
+        if( generation != forkGeneration() )
+        {
+            errno = ECHILD;
+            return false;
+        }
+
+        while( size > 0 )
+        {
+            if( 0 == available )
+            {
+                chachaBlock( key, counter++, stream, block );
+                available = sizeof(block);
+            }
+
+            const size_t chunk = ( size < available ) ? size : available;
+
+            memcpy( dst, block + sizeof(block) - available, chunk );
+
+            dst += chunk;
+            size -= chunk;
+            available -= chunk;
+        }
+
+        return true;
+    }
+
+private:
+    uint32_t key[CHACHA_KEY_WORDS];
+    uint8_t block[CHACHA_BLOCK_SIZE];
+    uint64_t stream;
+    uint64_t counter;
+    size_t available;
+    unsigned generation;  // forkGeneration() of the creating process
+
+};
+
+
+volatile unsigned EntropySource::forkCounter = 0;
+
+
+EntropySource::EntropySource()
+{
+}
+
+
+EntropySource::~EntropySource()
+{
+}
+
+
+EntropySource *EntropySource::create( EntropyBackend backend )
+{
+    pthread_once( &forkHandlerOnce, &EntropySource::installForkHandler );
+
+    switch( backend )
+    {
+        case EB_OPENSSL:   return new OpenSslSource();
+        case EB_GETRANDOM: return new GetrandomSource();
+        case EB_CHACHA20:  return new ChaChaSource();
+        default:           return NULL;
+    }
+}
+
+
+EntropySource *EntropySource::createSeeded( const uint8_t *seedKey, uint64_t stream )
+{
+    pthread_once( &forkHandlerOnce, &EntropySource::installForkHandler );
+
+    return new SeededSource( seedKey, stream );
+}
+
+
+const char *EntropySource::backendName( EntropyBackend backend )
+{
+    if( backend < 0 || backend >= EB_COUNT )
+        return "unknown";
+
+    return backendNames[backend];
+}
+
+
+bool EntropySource::parseBackend( const char *name, EntropyBackend *dst )
+{
+    for( int i = 0; i < EB_COUNT; ++i )
+        if( strcasecmp( name, backendNames[i] ) == 0 )
+        {
+            *dst = (EntropyBackend)i;
+            return true;
+        }
+
+    return false;
+}
+
+
+void EntropySource::installForkHandler()
+{
+    pthread_atfork( NULL, NULL, &EntropySource::onForkChild );
+}
+
+
+void EntropySource::onForkChild()
+{
+    // Only the forking thread exists in the child, no locking needed
+    forkCounter++;
+}
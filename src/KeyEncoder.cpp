@@ -0,0 +1,379 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "KeyEncoder.h"
+
+#include <openssl/crypto.h>
+
+#include <string.h>
+#include <strings.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEY_ENCODER_X86
+#endif
+
+
+#define BASE58_LIMB         656356768U  // 58**5, the largest power of 58 in 32 bits
+#define BASE58_LIMB_DIGITS  5
+#define BASE58_STACK_BYTES  256         // Longer keys use heap scratch
+
+static const char *encodingNames[KE_COUNT] = { "hex", "base64", "base64url", "base32", "base58" };
+
+static const char hexAlphabet[16+1] = "0123456789abcdef";
+static const char base64Alphabet[64+1] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char base64UrlAlphabet[64+1] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+static const char base32Alphabet[32+1] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+static const char base58Alphabet[58+1] = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+
+
+/*
+ * Vector kernels encode whole input blocks and return the number of bytes
+ * consumed, the scalar code finishes the tail. Every kernel loads 16 bytes
+ * at a time and never reads past src + bytes.
+ */
+#ifdef KEY_ENCODER_X86
+
+static bool haveSsse3()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports( "ssse3" );
+}
+
+
+// 16 bytes to 32 hex chars per step
+__attribute__((target("ssse3")))
+static size_t encodeHexSsse3( char *dst, const uint8_t *src, size_t bytes )
+{
+    const __m128i alphabet = _mm_loadu_si128( (const __m128i*)hexAlphabet );
+    const __m128i lowNibble = _mm_set1_epi8( 0x0F );
+    size_t i = 0;
+
+    for( ; i + 16 <= bytes; i += 16, dst += 32 )
+    {
+        const __m128i in = _mm_loadu_si128( (const __m128i*)( src + i ) );
+        const __m128i high = _mm_shuffle_epi8( alphabet, _mm_and_si128( _mm_srli_epi16( in, 4 ), lowNibble ) );
+        const __m128i low = _mm_shuffle_epi8( alphabet, _mm_and_si128( in, lowNibble ) );
+
+        _mm_storeu_si128( (__m128i*)dst, _mm_unpacklo_epi8( high, low ) );
+        _mm_storeu_si128( (__m128i*)( dst + 16 ), _mm_unpackhi_epi8( high, low ) );
+    }
+
+    return i;
+}
+
+
+/*
+ * 12 bytes to 16 base64 chars per step, W. Mula's method: every 3 bytes are
+ * spread over a 32-bit lane, 6-bit fields are moved in place with 16-bit
+ * multiplies and the ASCII offset of each index range is taken by pshufb.
+ */
+__attribute__((target("ssse3")))
+static size_t encodeBase64Ssse3( char *dst, const uint8_t *src, size_t bytes, bool url )
+{
+    const __m128i spread = _mm_setr_epi8( 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10 );
+    const __m128i offsets = _mm_setr_epi8( 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           ( url ? '-' : '+' ) - 62, ( url ? '_' : '/' ) - 63, 'A', 0, 0 );
+    size_t i = 0;
+
+    for( ; i + 16 <= bytes; i += 12, dst += 16 )
+    {
+        const __m128i in = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)( src + i ) ), spread );
+
+        const __m128i high = _mm_mulhi_epu16( _mm_and_si128( in, _mm_set1_epi32( 0x0FC0FC00 ) ),
+                                              _mm_set1_epi32( 0x04000040 ) );
+        const __m128i low = _mm_mullo_epi16( _mm_and_si128( in, _mm_set1_epi32( 0x003F03F0 ) ),
+                                             _mm_set1_epi32( 0x01000010 ) );
+        const __m128i index = _mm_or_si128( high, low );
+
+        // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+        __m128i range = _mm_subs_epu8( index, _mm_set1_epi8( 51 ) );
+        range = _mm_or_si128( range, _mm_and_si128( _mm_cmpgt_epi8( _mm_set1_epi8( 26 ), index ),
+                                                    _mm_set1_epi8( 13 ) ) );
+
+        _mm_storeu_si128( (__m128i*)dst, _mm_add_epi8( index, _mm_shuffle_epi8( offsets, range ) ) );
+    }
+
+    return i;
+}
+
+
+/*
+ * 10 bytes to 16 base32 chars per step. 16-bit lane k gets the big-endian
+ * byte pair holding char k % 8 of its 5-byte group, the field is shifted
+ * down by a per-lane mulhi.
+ */
+__attribute__((target("ssse3")))
+static size_t encodeBase32Ssse3( char *dst, const uint8_t *src, size_t bytes )
+{
+    const __m128i spreadLow = _mm_setr_epi8( 1, 0, 1, 0, 2, 1, 2, 1, 3, 2, 4, 3, 4, 3, 5, 4 );
+    const __m128i spreadHigh = _mm_setr_epi8( 6, 5, 6, 5, 7, 6, 7, 6, 8, 7, 9, 8, 9, 8, 10, 9 );
+    // Char k starts at bit 5 * k of the group: word >> ( 11 - ( 5 * k ) % 8 )
+    const __m128i shifts = _mm_setr_epi16( 1 << 5, 1 << 10, 1 << 7, 1 << 12, 1 << 9, 1 << 6, 1 << 11, 1 << 8 );
+    const __m128i fieldMask = _mm_set1_epi16( 0x1F );
+    size_t i = 0;
+
+    for( ; i + 16 <= bytes; i += 10, dst += 16 )
+    {
+        const __m128i in = _mm_loadu_si128( (const __m128i*)( src + i ) );
+        const __m128i low = _mm_and_si128( _mm_mulhi_epu16( _mm_shuffle_epi8( in, spreadLow ), shifts ), fieldMask );
+        const __m128i high = _mm_and_si128( _mm_mulhi_epu16( _mm_shuffle_epi8( in, spreadHigh ), shifts ), fieldMask );
+        const __m128i index = _mm_packus_epi16( low, high );
+
+        // 'A'..'Z' for 0..25, '2'..'7' for 26..31
+        const __m128i digits = _mm_and_si128( _mm_cmpgt_epi8( index, _mm_set1_epi8( 25 ) ),
+                                              _mm_set1_epi8( '2' - 26 - 'A' ) );
+
+        _mm_storeu_si128( (__m128i*)dst, _mm_add_epi8( index, _mm_add_epi8( digits, _mm_set1_epi8( 'A' ) ) ) );
+    }
+
+    return i;
+}
+
+#endif // KEY_ENCODER_X86
+
+
+static size_t encodeHex( char *dst, const uint8_t *src, size_t bytes )
+{
+    size_t i = 0;
+
+#ifdef KEY_ENCODER_X86
+    static const bool vector = haveSsse3();
+    if( vector )
+        i = encodeHexSsse3( dst, src, bytes );
+#endif
+
+    for( ; i < bytes; ++i )
+    {
+        dst[i * 2] = hexAlphabet[src[i] >> 4];
+        dst[i * 2 + 1] = hexAlphabet[src[i] & 15];
+    }
+
+    return bytes * 2;
+}
+
+
+static size_t encodeBase64( char *dst, const uint8_t *src, size_t bytes, bool url )
+{
+    const char *alphabet = url ? base64UrlAlphabet : base64Alphabet;
+    char *out = dst;
+    size_t i = 0;
+
+#ifdef KEY_ENCODER_X86
+    static const bool vector = haveSsse3();
+    if( vector )
+    {
+        i = encodeBase64Ssse3( out, src, bytes, url );
+        out += i / 3 * 4;
+    }
+#endif
+
+    for( ; i + 3 <= bytes; i += 3 )
+    {
+        const uint32_t v = ( src[i] << 16 ) | ( src[i + 1] << 8 ) | src[i + 2];
+
+        *out++ = alphabet[v >> 18];
+        *out++ = alphabet[( v >> 12 ) & 63];
+        *out++ = alphabet[( v >> 6 ) & 63];
+        *out++ = alphabet[v & 63];
+    }
+
+    if( i < bytes )
+    {
+        const uint32_t v = ( src[i] << 16 ) | ( ( i + 1 < bytes ) ? src[i + 1] << 8 : 0 );
+
+        *out++ = alphabet[v >> 18];
+        *out++ = alphabet[( v >> 12 ) & 63];
+
+        if( i + 1 < bytes )
+            *out++ = alphabet[( v >> 6 ) & 63];
+        else if( !url )
+            *out++ = '=';
+
+        if( !url )
+            *out++ = '=';
+    }
+
+    return out - dst;
+}
+
+
+static size_t encodeBase32( char *dst, const uint8_t *src, size_t bytes )
+{
+    char *out = dst;
+    size_t i = 0;
+
+#ifdef KEY_ENCODER_X86
+    static const bool vector = haveSsse3();
+    if( vector )
+    {
+        i = encodeBase32Ssse3( out, src, bytes );
+        out += i / 5 * 8;
+    }
+#endif
+
+    for( ; i < bytes; i += 5 )
+    {
+        // Last group is zero-extended, chars without input bits become padding
+        const size_t groupBytes = ( bytes - i < 5 ) ? bytes - i : 5;
+        uint64_t v = 0;
+
+        for( size_t j = 0; j < 5; ++j )
+            v = ( v << 8 ) | ( ( j < groupBytes ) ? src[i + j] : 0 );
+
+        const size_t chars = ( groupBytes * 8 + 4 ) / 5;
+        for( size_t j = 0; j < 8; ++j )
+            *out++ = ( j < chars ) ? base32Alphabet[( v >> ( 35 - 5 * j ) ) & 31] : '=';
+    }
+
+    return out - dst;
+}
+
+
+static size_t encodeBase58( char *dst, const uint8_t *src, size_t bytes )
+{
+    /*
+     * The number is kept as big-endian 32-bit limbs and divided by 58**5 until
+     * zero, each remainder gives 5 digits. Leading zero bytes are not part of
+     * the number, every one of them is written as '1'.
+     */
+    size_t zeros = 0;
+    while( zeros < bytes && 0 == src[zeros] )
+        ++zeros;
+
+    const size_t limbCount = ( bytes - zeros + 3 ) / 4;
+    const size_t maxDigits = KeyEncoder::encodedLength( KE_BASE58, bytes ) + BASE58_LIMB_DIGITS;
+
+    uint32_t stackLimbs[BASE58_STACK_BYTES / 4 + 1];
+    char stackDigits[BASE58_STACK_BYTES * 138 / 100 + 1 + BASE58_LIMB_DIGITS];
+    std::vector<uint32_t> heapLimbs;
+    std::vector<char> heapDigits;
+
+    uint32_t *limbs = stackLimbs;
+    char *digits = stackDigits;
+    if( bytes > BASE58_STACK_BYTES )
+    {
+        heapLimbs.resize( limbCount + 1 );
+        heapDigits.resize( maxDigits );
+        limbs = &heapLimbs[0];
+        digits = &heapDigits[0];
+    }
+
+    // Most significant limb takes the odd bytes
+    memset( limbs, 0, limbCount * sizeof(limbs[0]) );
+    for( size_t i = zeros, pos = ( 4 - ( bytes - zeros ) % 4 ) % 4; i < bytes; ++i, ++pos )
+        limbs[pos / 4] = ( limbs[pos / 4] << 8 ) | src[i];
+
+    size_t first = 0;
+    size_t digitCount = 0;
+
+    while( first < limbCount )
+    {
+        uint64_t remainder = 0;
+        for( size_t i = first; i < limbCount; ++i )
+        {
+            const uint64_t value = ( remainder << 32 ) | limbs[i];
+            limbs[i] = (uint32_t)( value / BASE58_LIMB );
+            remainder = value % BASE58_LIMB;
+        }
+
+        while( first < limbCount && 0 == limbs[first] )
+            ++first;
+
+        for( int i = 0; i < BASE58_LIMB_DIGITS; ++i )
+        {
+            digits[digitCount++] = (char)( remainder % 58 );
+            remainder /= 58;
+        }
+    }
+
+    // Digits are least significant first, the last limb gave leading zeros
+    while( digitCount > 0 && 0 == digits[digitCount - 1] )
+        --digitCount;
+
+    char *out = dst;
+    for( size_t i = 0; i < zeros; ++i )
+        *out++ = base58Alphabet[0];
+
+    while( digitCount > 0 )
+        *out++ = base58Alphabet[(int)digits[--digitCount]];
+
+    // Limbs and digits are the key itself
+    OPENSSL_cleanse( limbs, limbCount * sizeof(limbs[0]) );
+    OPENSSL_cleanse( digits, maxDigits );
+
+    return out - dst;
+}
+
+
+size_t KeyEncoder::encodedLength( KeyEncoding encoding, size_t bytes )
+{
+    switch( encoding )
+    {
+        case KE_HEX:       return bytes * 2;
+        case KE_BASE64:    return ( bytes + 2 ) / 3 * 4;
+        case KE_BASE64URL: return ( bytes * 4 + 2 ) / 3;
+        case KE_BASE32:    return ( bytes + 4 ) / 5 * 8;
+        case KE_BASE58:    return bytes * 138 / 100 + 1;  // log(256) / log(58) < 1.38
+        default:           return 0;
+    }
+}
+
+
+size_t KeyEncoder::encode( KeyEncoding encoding, char *dst, const uint8_t *src, size_t bytes )
+{
+    switch( encoding )
+    {
+        case KE_HEX:       return encodeHex( dst, src, bytes );
+        case KE_BASE64:    return encodeBase64( dst, src, bytes, false );
+        case KE_BASE64URL: return encodeBase64( dst, src, bytes, true );
+        case KE_BASE32:    return encodeBase32( dst, src, bytes );
+        case KE_BASE58:    return encodeBase58( dst, src, bytes );
+        default:           return 0;
+    }
+}
+
+
+const char *KeyEncoder::encodingName( KeyEncoding encoding )
+{
+    if( encoding < 0 || encoding >= KE_COUNT )
+        return "unknown";
+
+    return encodingNames[encoding];
+}
+
+
+bool KeyEncoder::parseEncoding( const char *name, KeyEncoding *dst )
+{
+    for( int i = 0; i < KE_COUNT; ++i )
+        if( strcasecmp( name, encodingNames[i] ) == 0 )
+        {
+            *dst = (KeyEncoding)i;
+            return true;
+        }
+
+    return false;
+}
@@ -0,0 +1,188 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "KeyedPermutation.h"
+#include "Randomizer.h"
+
+#include <errno.h>
+#include <openssl/crypto.h>
+
+
+static inline uint64_t rotl( uint64_t x, int bits )
+{
+    return ( x << bits ) | ( x >> ( 64 - bits ) );
+}
+
+
+static inline void sipRound( uint64_t *v )
+{
+    v[0] += v[1]; v[1] = rotl( v[1], 13 ); v[1] ^= v[0]; v[0] = rotl( v[0], 32 );
+    v[2] += v[3]; v[3] = rotl( v[3], 16 ); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = rotl( v[3], 21 ); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = rotl( v[1], 17 ); v[1] ^= v[2]; v[2] = rotl( v[2], 32 );
+}
+
+
+// SipHash-2-4 of a single 8 byte message
+static uint64_t sipHash( const uint64_t key[2], uint64_t message )
+{
+    uint64_t v[4] = { key[0] ^ 0x736F6D6570736575ULL, key[1] ^ 0x646F72616E646F6DULL,
+                      key[0] ^ 0x6C7967656E657261ULL, key[1] ^ 0x7465646279746573ULL };
+    const uint64_t last = 8ULL << 56;
+
+    v[3] ^= message; sipRound( v ); sipRound( v ); v[0] ^= message;
+    v[3] ^= last;    sipRound( v ); sipRound( v ); v[0] ^= last;
+
+    v[2] ^= 0xFF;
+    sipRound( v ); sipRound( v ); sipRound( v ); sipRound( v );
+
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+
+KeyedPermutation *KeyedPermutation::create( uint64_t maxValue )
+{
+    if( 0 == maxValue )
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    KeyedPermutation *res = new KeyedPermutation( maxValue );
+
+    if( !Randomizer::makeBytes( (uint8_t *)res->key, sizeof(res->key) ) )
+    {
+        delete res;
+        errno = EIO;
+        return NULL;
+    }
+
+    return res;
+}
+
+
+KeyedPermutation::KeyedPermutation( uint64_t maxValue )
+: lastValue( maxValue )
+, halfBits( 1 )
+{
+    while( halfBits < 32 && ( maxValue >> ( 2 * halfBits ) ) != 0 )
+        ++halfBits;
+
+    halfMask = ( 1ULL << halfBits ) - 1;
+    key[0] = key[1] = 0;
+}
+
+
+KeyedPermutation::~KeyedPermutation()
+{
+    OPENSSL_cleanse( key, sizeof(key) );
+}
+
+
+uint64_t KeyedPermutation::map( uint64_t index ) const
+{
+    // index lies on a cycle of the domain permutation, so the walk ends
+    uint64_t value = encrypt( index );
+
+    while( value > lastValue )
+        value = encrypt( value );
+
+    return value;
+}
+
+
+uint64_t KeyedPermutation::encrypt( uint64_t value ) const
+{
+    uint64_t left = value >> halfBits;
+    uint64_t right = value & halfMask;
+
+    for( int round = 0; round < PERMUTATION_ROUNDS; ++round )
+    {
+        // Round number and half width above the half value keep the round functions apart
+        const uint64_t mixed = left ^ ( sipHash( key, right | ( (uint64_t)( round << 6 | halfBits ) << 48 ) ) & halfMask );
+
+        left = right;
+        right = mixed;
+    }
+
+    return ( left << halfBits ) | right;
+}
+
+
+size_t KeyedPermutation::writePins( char *dst, size_t stride, int digits, uint64_t first, size_t count ) const
+{
+    for( size_t i = 0; i < count; ++i, dst += stride )
+    {
+        uint64_t value = map( first + i );
+
+        for( int j = digits - 1; j >= 0; --j, value /= 10 )
+            dst[j] = '0' + value % 10;
+    }
+
+    return count;
+}
+
+
+size_t KeyedPermutation::writeKeys( char *dst, size_t capacity, uint32_t *offsets, char separator,
+                                    int bytes, KeyEncoding encoding, uint64_t first, size_t count ) const
+{
+    const size_t itemCapacity = KeyEncoder::encodedLength( encoding, bytes ) + 1;
+    uint8_t raw[PERMUTATION_MAX_BYTES];
+    size_t used = 0;
+    size_t i;
+
+    for( i = 0; i < count && capacity - used >= itemCapacity; ++i )
+    {
+        uint64_t value = map( first + i );
+
+        for( int j = bytes - 1; j >= 0; --j, value >>= 8 )
+            raw[j] = (uint8_t)value;
+
+        offsets[i] = used;
+        used += KeyEncoder::encode( encoding, dst + used, raw, bytes );
+        dst[used++] = separator;
+    }
+
+    OPENSSL_cleanse( raw, sizeof(raw) );
+
+    offsets[i] = used;
+    return i;
+}
+
+
+uint64_t KeyedPermutation::pinMaxValue( int digits )
+{
+    uint64_t res = 1;
+
+    for( int i = 0; i < digits; ++i )
+        res *= 10;
+
+    return res - 1;
+}
+
+
+uint64_t KeyedPermutation::keyMaxValue( int bytes )
+{
+    return ( bytes >= 8 ) ? UINT64_MAX : ( 1ULL << ( 8 * bytes ) ) - 1;
+}
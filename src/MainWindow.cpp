@@ -30,23 +30,48 @@
 #include <QtGui/QAction>
 #include <QtGui/QLabel>
 #include <QtGui/QLineEdit>
+#include <QtGui/QClipboard>
+#include <QtGui/QStyle>
+#include <QtGui/QStyledItemDelegate>
 #include <QtGui/QHeaderView>
 #include <QtGui/QButtonGroup>
 #include <QtGui/QHBoxLayout>
 #include <QtGui/QVBoxLayout>
 #include <QtGui/QSplitter>
 #include <QtGui/QMessageBox>
+#include <QtGui/QInputDialog>
 
 #include "StorageEngine.h"
 #include "Randomizer.h"
 
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
 
 #define DATA_COLUMN_COUNT    3
 #define QUICK_SEARCH_COLUMNS 2
+#define PASSWORD_COLUMN      2
 #define COMMENT_CELL_INDEX   DATA_COLUMN_COUNT
 
-#define SHORTCUT_DELETE_ROW  "del"
-#define SHORTCUT_RANDOMIZE   "Ctrl+R"
+#define SHORTCUT_DELETE_ROW    "del"
+#define SHORTCUT_RANDOMIZE     "Ctrl+R"
+#define SHORTCUT_SHOW_PASSWORD "Ctrl+P"
+#define SHORTCUT_COPY_PASSWORD "Ctrl+Shift+C"
+
+#define EDIT_HISTORY_DEPTH   10000
+
+// Fixed-length mask, so the placeholder does not reveal the password length
+#define PASSWORD_MASK_CHAR   0x2022
+#define PASSWORD_MASK_LENGTH 8
+
+enum ContextMenuAction
+{
+    CMA_DELETE_ROW    = -1,
+    CMA_SHOW_PASSWORD = -2,
+    CMA_COPY_PASSWORD = -3
+};
 
 enum PasswordRandomMode
 {
@@ -58,6 +83,14 @@ enum PasswordRandomMode
     PRM_KEY_128,
     PRM_KEY_192,
     PRM_KEY_256,
+    PRM_KEY_256_BASE64,
+    PRM_KEY_256_BASE64URL,
+    PRM_KEY_160_BASE32,
+    PRM_KEY_256_BASE58,
+    PRM_POLICY_WEB,
+    PRM_POLICY_ALNUM,
+    PRM_POLICY_STRONG,
+    PRM_POLICY_CUSTOM,
 };
 
 #define DEFAULT_PASSWORD_TYPE   PRM_PASS_12
@@ -67,8 +100,175 @@ static const char *dataColumnHeaders[DATA_COLUMN_COUNT] = { "Service", "Login",
 static const char *randomDomainSet[] = { ".com", ".net", ".org", ".info", "" };
 
 
+// Output distribution of a fixed password mode
+static OutputEntropy passwordModeEntropy( int mode )
+{
+    switch( mode )
+    {
+        case PRM_PIN_4:              return Randomizer::pinEntropy( 4, 4 );
+        case PRM_PASS_8:             return Randomizer::passwordEntropy( 8, 8 );
+        case PRM_PASS_12:            return Randomizer::passwordEntropy( 12, 12 );
+        case PRM_PASS_16:            return Randomizer::passwordEntropy( 16, 16 );
+        case PRM_PASS_32:            return Randomizer::passwordEntropy( 32, 32 );
+        case PRM_KEY_128:            return Randomizer::keyEntropy( 16, 16 );
+        case PRM_KEY_192:            return Randomizer::keyEntropy( 24, 24 );
+        case PRM_KEY_256:
+        case PRM_KEY_256_BASE64:
+        case PRM_KEY_256_BASE64URL:
+        case PRM_KEY_256_BASE58:     return Randomizer::keyEntropy( 32, 32 );
+        case PRM_KEY_160_BASE32:     return Randomizer::keyEntropy( 20, 20 );
+        case PRM_POLICY_WEB:         return Randomizer::passwordEntropy( presetPolicyTable<policyWeb>() );
+        case PRM_POLICY_ALNUM:       return Randomizer::passwordEntropy( presetPolicyTable<policyAlnum>() );
+        case PRM_POLICY_STRONG:      return Randomizer::passwordEntropy( presetPolicyTable<policyStrong>() );
+        default:                     break;
+    }
+
+    const OutputEntropy unknown = { 0, 0, false };
+    return unknown;
+}
+
+
+/*
+ * Custom password policy as "<length>[-<max length>] <policy>", see
+ * PasswordPolicy::parse(). Forbidden chars of the result point into spec.
+ */
+static bool parsePolicySpec( const QByteArray &spec, PasswordPolicy *dst )
+{
+    PasswordPolicy policy = { 0, 0, CC_ALL, { 0, 0, 0, 0 }, NULL };
+    const char *text = spec.constData();
+    int minLength, maxLength, used;
+
+    if( sscanf( text, "%d%n", &minLength, &used ) != 1 )
+        return false;
+
+    text += used;
+    maxLength = minLength;
+
+    if( '-' == *text )
+    {
+        if( sscanf( text + 1, "%d%n", &maxLength, &used ) != 1 )
+            return false;
+
+        text += 1 + used;
+    }
+
+    while( ' ' == *text )
+        ++text;
+
+    if( !PasswordPolicy::parse( text, &policy ) )
+        return false;
+
+    policy.minLength = minLength;
+    policy.maxLength = maxLength;
+
+    *dst = policy;
+    return policy.isValid();
+}
+
+
+/*
+ * Row comparison for sortTable(): plain byte comparison of precomputed
+ * strxfrm() keys gives the same order as strcoll() on the original text.
+ */
+struct CollationKeyLess
+{
+    CollationKeyLess( const QVector<QByteArray> &rowKeys, bool reverse )
+    : keys( rowKeys )
+    , descending( reverse )
+    {
+    }
+
+    bool operator () ( int a, int b ) const
+    {
+        return descending ? ( keys[b] < keys[a] ) : ( keys[a] < keys[b] );
+    }
+
+    const QVector<QByteArray> &keys;
+    const bool descending;
+};
+
+
+/*
+ * Default delegate of the table. Wraps every committed cell edit, so the
+ * window can record the row content before and after it for undo.
+ */
+class RowEditDelegate : public QStyledItemDelegate
+{
+public:
+    RowEditDelegate( MainWindow *owner )
+    : QStyledItemDelegate( owner )
+    , window( owner )
+    {
+    }
+
+    void setModelData( QWidget *editor, QAbstractItemModel *model, const QModelIndex &index ) const
+    {
+        window->beginRowChange( index.row() );
+        QStyledItemDelegate::setModelData( editor, model, index );
+        window->endRowChange();
+    }
+
+protected:
+    MainWindow *window;
+
+};
+
+
+/*
+ * Password cells have no table items until they are revealed, edited or
+ * generated. Secrets stay in the engine rows and the delegate only draws
+ * a mask, unless the row is the one explicitly revealed by the user.
+ */
+class PasswordDelegate : public RowEditDelegate
+{
+public:
+    PasswordDelegate( MainWindow *owner )
+    : RowEditDelegate( owner )
+    {
+    }
+
+    void paint( QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index ) const
+    {
+        if( index.row() == window->revealedRow )
+        {
+            QStyledItemDelegate::paint( painter, option, index );
+            return;
+        }
+
+        QStyleOptionViewItemV4 maskedOption( option );
+        initStyleOption( &maskedOption, index );
+
+        if( window->hasPassword( index.row() ) )
+            maskedOption.text = QString( PASSWORD_MASK_LENGTH, QChar( PASSWORD_MASK_CHAR ) );
+        else
+            maskedOption.text.clear();
+
+        const QWidget *widget = maskedOption.widget;
+        QStyle *style = ( NULL != widget ) ? widget->style() : QApplication::style();
+        style->drawControl( QStyle::CE_ItemViewItem, &maskedOption, painter, widget );
+    }
+
+    void setEditorData( QWidget *editor, const QModelIndex &index ) const
+    {
+        QLineEdit *lineEdit = qobject_cast<QLineEdit*>( editor );
+        if( NULL != lineEdit )
+            lineEdit->setText( window->passwordText( index.row() ) );
+        else
+            QStyledItemDelegate::setEditorData( editor, index );
+    }
+
+};
+
+
 MainWindow::MainWindow( const QString &title, StorageEngine *storage )
 : storageEngine( storage )
+, revealedRow( -1 )
+, sortColumn( -1 )
+, sortOrder( Qt::AscendingOrder )
+, nextRowId( 0 )
+, history( EDIT_HISTORY_DEPTH )
+, changingRow( -1 )
+, changingNewRow( false )
 , dataChanged( false )
 , curPassRandMode( DEFAULT_PASSWORD_TYPE )
 {
@@ -114,14 +314,17 @@ MainWindow::MainWindow( const QString &title, StorageEngine *storage )
     mainTable->setVerticalScrollMode( QAbstractItemView::ScrollPerPixel );
     mainTable->setHorizontalScrollMode( QAbstractItemView::ScrollPerPixel );
     mainTable->setAlternatingRowColors( true );
-    mainTable->setSortingEnabled( false );
+    mainTable->setSortingEnabled( false ); // See sortTable()
     mainTable->setWordWrap( false );
     mainTable->horizontalHeader()->setVisible( true );
     mainTable->verticalHeader()->setVisible( false );
     mainTable->horizontalHeader()->setDefaultSectionSize( 250 );
     mainTable->horizontalHeader()->setMinimumSectionSize( 75 );
     mainTable->horizontalHeader()->setStretchLastSection( true );
+    mainTable->horizontalHeader()->setClickable( true );
     mainTable->setContextMenuPolicy( Qt::CustomContextMenu );
+    mainTable->setItemDelegate( new RowEditDelegate( this ) );
+    mainTable->setItemDelegateForColumn( PASSWORD_COLUMN, new PasswordDelegate( this ) );
     splitter->addWidget( mainTable );
 
     QAction *deleteAction = new QAction( mainTable );
@@ -132,6 +335,22 @@ MainWindow::MainWindow( const QString &title, StorageEngine *storage )
     randomizeAction->setShortcut( QString( SHORTCUT_RANDOMIZE ) );
     mainTable->addAction( randomizeAction );
 
+    QAction *showPasswordAction = new QAction( mainTable );
+    showPasswordAction->setShortcut( QString( SHORTCUT_SHOW_PASSWORD ) );
+    mainTable->addAction( showPasswordAction );
+
+    QAction *copyPasswordAction = new QAction( mainTable );
+    copyPasswordAction->setShortcut( QString( SHORTCUT_COPY_PASSWORD ) );
+    mainTable->addAction( copyPasswordAction );
+
+    QAction *undoAction = new QAction( mainTable );
+    undoAction->setShortcuts( QKeySequence::Undo );
+    mainTable->addAction( undoAction );
+
+    QAction *redoAction = new QAction( mainTable );
+    redoAction->setShortcuts( QKeySequence::Redo );
+    mainTable->addAction( redoAction );
+
     commentEdit = new QPlainTextEdit( splitter );
     commentEdit->setSizePolicy( sizePolicy1x );
     splitter->addWidget( commentEdit );
@@ -153,10 +372,20 @@ MainWindow::MainWindow( const QString &title, StorageEngine *storage )
              this, SLOT(changeCellEvent(int, int, int, int)) );
     connect( mainTable, SIGNAL(customContextMenuRequested(const QPoint&)),
              this, SLOT(tableContextMenuEvent(const QPoint&)) );
+    connect( mainTable->horizontalHeader(), SIGNAL(sectionClicked(int)),
+             this, SLOT(sortTable(int)) );
     connect( deleteAction, SIGNAL(triggered(bool)),
              this, SLOT(deleteRow(bool)) );
     connect( randomizeAction, SIGNAL(triggered(bool)),
              this, SLOT(randomizeCell(bool)) );
+    connect( showPasswordAction, SIGNAL(triggered(bool)),
+             this, SLOT(revealPassword(bool)) );
+    connect( copyPasswordAction, SIGNAL(triggered(bool)),
+             this, SLOT(copyPassword(bool)) );
+    connect( undoAction, SIGNAL(triggered(bool)),
+             this, SLOT(undo(bool)) );
+    connect( redoAction, SIGNAL(triggered(bool)),
+             this, SLOT(redo(bool)) );
     connect( closeButtonBox, SIGNAL(clicked(QAbstractButton*)),
              this, SLOT(closeButtonEvent(QAbstractButton*)) );
 }
@@ -187,6 +416,9 @@ void MainWindow::loadTableContent()
     mainTable->setColumnCount( 3 );
     mainTable->setRowCount( storageEngine->data.size() + 1 );
     commentStorage.reserve( storageEngine->data.size() );
+    rowSources.reserve( storageEngine->data.size() );
+    rowIds.reserve( storageEngine->data.size() );
+    idRows.reserve( storageEngine->data.size() );
 
     for( int col = 0; col < DATA_COLUMN_COUNT; ++col )
         mainTable->setHorizontalHeaderItem( col, new QTableWidgetItem( dataColumnHeaders[col] ) );
@@ -194,14 +426,22 @@ void MainWindow::loadTableContent()
     int curRowIndex = 0;
     for( std::multiset<DataRow>::iterator i = storageEngine->data.begin(); i != storageEngine->data.end(); ++i )
     {
+        // Password column is left without items, see PasswordDelegate
         for( int col = 0; col < DATA_COLUMN_COUNT; ++col )
-            mainTable->setItem( curRowIndex, col, new QTableWidgetItem( QString::fromUtf8( i->cells[col] ) ) );
-
-        commentStorage.push_back( QString::fromUtf8( i->cells[COMMENT_CELL_INDEX] ) );
+            if( PASSWORD_COLUMN != col )
+                mainTable->setItem( curRowIndex, col, new QTableWidgetItem( QString::fromUtf8( i->cells[col] ) ) );
+
+        // Implicitly shared with the engine row, no copy and no decoding here
+        commentStorage.push_back( i->cells[COMMENT_CELL_INDEX] );
+        rowSources.push_back( i );
+        rowIds.push_back( curRowIndex );
+        idRows.push_back( curRowIndex );
         curRowIndex++;
     }
 
-    storageEngine->data.clear();
+    nextRowId = curRowIndex;
+
+    // Engine data is kept: save() only replaces the entries of changed rows
 
     // Since signals are not connected to the slots, call slot explicitly
     mainTable->setCurrentCell( 0, 0 );
@@ -211,36 +451,28 @@ void MainWindow::loadTableContent()
 
 bool MainWindow::save()
 {
-    if( commentEdit->document()->isModified() )
-    {
-        const int curRow = mainTable->currentRow();
-        if( curRow >= 0 && curRow < commentStorage.size() )
-            commentStorage[curRow] = commentEdit->toPlainText();
+    commitComment( mainTable->currentRow() );
+    commentEdit->document()->setModified( false );
 
-        commentEdit->document()->setModified( false );
-    }
+    std::multiset<DataRow> &data = storageEngine->data;
 
-    const int rowCount = mainTable->rowCount() - 1;
+    for( int i = 0; i < deletedSources.size(); ++i )
+        data.erase( deletedSources[i] );
 
-    storageEngine->data.clear();
+    deletedSources.clear();
 
-    for( int row = 0; row < rowCount; ++row )
+    for( std::set<int>::iterator i = dirtyRows.begin(); i != dirtyRows.end(); ++i )
     {
-        DataRow dataEntry;
+        const int row = *i;
 
-        for( int col = 0; col < DATA_COLUMN_COUNT; ++col )
-        {
-            QTableWidgetItem *item = mainTable->item( row, col );
-            if( NULL != item )
-                dataEntry.cells[col] = item->text().toUtf8();
-        }
-
-        if( commentStorage.size() > row )
-            dataEntry.cells[COMMENT_CELL_INDEX] = commentStorage[row].toUtf8();
+        if( rowSources[row] != data.end() )
+            data.erase( rowSources[row] );
 
-        storageEngine->data.insert( dataEntry );
+        rowSources[row] = data.insert( rowContent( row ) );
     }
 
+    dirtyRows.clear();
+
     if( !storageEngine->writeDbFile() )
     {
         QMessageBox message( QMessageBox::Critical,
@@ -258,6 +490,346 @@ bool MainWindow::save()
 }
 
 
+void MainWindow::markRowDirty( int row )
+{
+    dirtyRows.insert( row );
+    dataChanged = true;
+}
+
+
+DataRow MainWindow::rowContent( int row ) const
+{
+    DataRow dataEntry;
+
+    for( int col = 0; col < DATA_COLUMN_COUNT; ++col )
+    {
+        QTableWidgetItem *item = mainTable->item( row, col );
+        if( NULL != item )
+            dataEntry.cells[col] = item->text().toUtf8();
+        else if( PASSWORD_COLUMN == col && rowSources[row] != storageEngine->data.end() )
+            dataEntry.cells[col] = rowSources[row]->cells[col];
+    }
+
+    if( commentStorage.size() > row )
+        dataEntry.cells[COMMENT_CELL_INDEX] = commentStorage[row];
+
+    return dataEntry;
+}
+
+
+bool MainWindow::hasPassword( int row ) const
+{
+    if( row < 0 || row >= rowSources.size() )
+        return false;
+
+    QTableWidgetItem *item = mainTable->item( row, PASSWORD_COLUMN );
+    if( NULL != item )
+        return !item->text().isEmpty();
+
+    return rowSources[row] != storageEngine->data.end()
+        && !rowSources[row]->cells[PASSWORD_COLUMN].isEmpty();
+}
+
+
+QString MainWindow::passwordText( int row ) const
+{
+    if( row < 0 || row >= rowSources.size() )
+        return QString();
+
+    QTableWidgetItem *item = mainTable->item( row, PASSWORD_COLUMN );
+    if( NULL != item )
+        return item->text();
+
+    if( rowSources[row] == storageEngine->data.end() )
+        return QString();
+
+    return QString::fromUtf8( rowSources[row]->cells[PASSWORD_COLUMN] );
+}
+
+
+QByteArray MainWindow::collationKey( int row, int column ) const
+{
+    QByteArray text;
+
+    QTableWidgetItem *item = mainTable->item( row, column );
+    if( NULL != item )
+        text = item->text().toLocal8Bit();
+
+    // QApplication has already called setlocale(), so LC_COLLATE is the user's one
+    const size_t keyLength = strxfrm( NULL, text.constData(), 0 );
+
+    QByteArray key( keyLength + 1, '\0' );
+    strxfrm( key.data(), text.constData(), keyLength + 1 );
+    key.resize( keyLength );
+
+    return key;
+}
+
+
+void MainWindow::applyRowOrder( const QVector<int> &order )
+{
+    // order[newRow] == oldRow. Trailing empty row is never moved.
+    const int rowCount = order.size();
+
+    QVector<int> newIndex( rowCount );
+    for( int row = 0; row < rowCount; ++row )
+        newIndex[order[row]] = row;
+
+    QVector<QTableWidgetItem*> items( rowCount * DATA_COLUMN_COUNT );
+    QVector<bool> hidden( rowCount );
+
+    mainTable->setUpdatesEnabled( false );
+    mainTable->blockSignals( true );
+
+    for( int row = 0; row < rowCount; ++row )
+    {
+        for( int col = 0; col < DATA_COLUMN_COUNT; ++col )
+            items[row * DATA_COLUMN_COUNT + col] = mainTable->takeItem( row, col );
+
+        hidden[row] = mainTable->isRowHidden( row );
+    }
+
+    for( int row = 0; row < rowCount; ++row )
+    {
+        const int oldRow = order[row];
+
+        for( int col = 0; col < DATA_COLUMN_COUNT; ++col )
+        {
+            QTableWidgetItem *item = items[oldRow * DATA_COLUMN_COUNT + col];
+            if( NULL != item )
+                mainTable->setItem( row, col, item );
+        }
+
+        mainTable->setRowHidden( row, hidden[oldRow] );
+    }
+
+    QVector<QByteArray> oldComments( commentStorage );
+    QVector<std::multiset<DataRow>::iterator> oldSources( rowSources );
+    QVector<int> oldIds( rowIds );
+
+    for( int row = 0; row < rowCount; ++row )
+    {
+        commentStorage[row] = oldComments[order[row]];
+        rowSources[row] = oldSources[order[row]];
+        rowIds[row] = oldIds[order[row]];
+    }
+
+    indexRows( 0 );
+
+    for( int i = 0; i < SORTABLE_COLUMNS_COUNT; ++i )
+    {
+        if( sortKeys[i].isEmpty() )
+            continue;
+
+        sortKeys[i].resize( rowCount );
+        QVector<QByteArray> oldKeys( sortKeys[i] );
+        for( int row = 0; row < rowCount; ++row )
+            sortKeys[i][row] = oldKeys[order[row]];
+    }
+
+    std::set<int> movedDirtyRows;
+    for( std::set<int>::iterator i = dirtyRows.begin(); i != dirtyRows.end(); ++i )
+        movedDirtyRows.insert( newIndex[*i] );
+
+    dirtyRows.swap( movedDirtyRows );
+
+    if( revealedRow >= 0 && revealedRow < rowCount )
+        revealedRow = newIndex[revealedRow];
+
+    // Keep the selection on the same entry; its comment is already shown
+    const int curRow = mainTable->currentRow();
+    if( curRow >= 0 && curRow < rowCount )
+        mainTable->setCurrentCell( newIndex[curRow], mainTable->currentColumn() );
+
+    mainTable->blockSignals( false );
+    mainTable->setUpdatesEnabled( true );
+}
+
+
+void MainWindow::beginRowChange( int row )
+{
+    changingRow = row;
+    changingNewRow = ( row >= rowSources.size() );
+
+    if( !changingNewRow )
+        changingBefore = rowContent( row );
+}
+
+
+void MainWindow::endRowChange()
+{
+    const int row = changingRow;
+    changingRow = -1;
+
+    // Nothing has been committed to the trailing row
+    if( row < 0 || row >= rowSources.size() )
+        return;
+
+    EditStep step;
+    step.rowId = rowIds[row];
+    step.row = row;
+    step.after = rowContent( row );
+
+    if( changingNewRow )
+    {
+        step.kind = ESK_INSERT_ROW;
+    }
+    else
+    {
+        if( changingBefore == step.after )
+            return;
+
+        step.kind = ESK_CHANGE_ROW;
+        step.before = changingBefore;
+    }
+
+    changingBefore = DataRow();
+    history.push( step );
+}
+
+
+void MainWindow::commitComment( int row )
+{
+    if( row < 0 || row >= commentStorage.size() || !commentEdit->document()->isModified() )
+        return;
+
+    beginRowChange( row );
+    commentStorage[row] = commentEdit->toPlainText().toUtf8();
+    commentEdit->document()->setModified( false );
+    markRowDirty( row );
+    endRowChange();
+}
+
+
+void MainWindow::syncCommentEdit()
+{
+    // Rows were moved with signals blocked, show the comment of the current one
+    changeCellEvent( mainTable->currentRow(), mainTable->currentColumn(), -1, -1 );
+}
+
+
+void MainWindow::setRowContent( int row, const DataRow &content )
+{
+    const std::multiset<DataRow>::iterator source = rowSources[row];
+
+    mainTable->blockSignals( true );
+
+    for( int col = 0; col < DATA_COLUMN_COUNT; ++col )
+    {
+        if( PASSWORD_COLUMN == col && row != revealedRow
+            && source != storageEngine->data.end() && source->cells[col] == content.cells[col] )
+        {
+            // Engine still holds this secret, drop the decoded copy
+            delete mainTable->takeItem( row, col );
+            continue;
+        }
+
+        const QString text = QString::fromUtf8( content.cells[col] );
+
+        QTableWidgetItem *item = mainTable->item( row, col );
+        if( NULL == item )
+            mainTable->setItem( row, col, new QTableWidgetItem( text ) );
+        else
+            item->setText( text );
+    }
+
+    mainTable->blockSignals( false );
+
+    commentStorage[row] = content.cells[COMMENT_CELL_INDEX];
+    if( row == mainTable->currentRow() )
+    {
+        commentEdit->document()->setPlainText( QString::fromUtf8( commentStorage[row] ) );
+        commentEdit->document()->setModified( false );
+    }
+
+    for( int i = 0; i < SORTABLE_COLUMNS_COUNT; ++i )
+        if( row < sortKeys[i].size() )
+            sortKeys[i][row] = QByteArray();
+
+    markRowDirty( row );
+}
+
+
+void MainWindow::insertTableRow( int row, int rowId, const DataRow &content )
+{
+    mainTable->blockSignals( true );
+    mainTable->insertRow( row );
+
+    for( int col = 0; col < DATA_COLUMN_COUNT; ++col )
+        if( !content.cells[col].isEmpty() )
+            mainTable->setItem( row, col, new QTableWidgetItem( QString::fromUtf8( content.cells[col] ) ) );
+
+    mainTable->blockSignals( false );
+
+    // Restored row is a new one for the engine, its old entry is removed on save
+    commentStorage.insert( row, content.cells[COMMENT_CELL_INDEX] );
+    rowSources.insert( row, storageEngine->data.end() );
+    rowIds.insert( row, rowId );
+    indexRows( row );
+
+    for( int i = 0; i < SORTABLE_COLUMNS_COUNT; ++i )
+        if( row <= sortKeys[i].size() && !sortKeys[i].isEmpty() )
+            sortKeys[i].insert( row, QByteArray() );
+
+    // Rows starting from the inserted one move down by one
+    std::set<int> shiftedRows;
+    for( std::set<int>::iterator i = dirtyRows.lower_bound( row ); i != dirtyRows.end(); ++i )
+        shiftedRows.insert( shiftedRows.end(), *i + 1 );
+
+    dirtyRows.erase( dirtyRows.lower_bound( row ), dirtyRows.end() );
+    dirtyRows.insert( shiftedRows.begin(), shiftedRows.end() );
+
+    markRowDirty( row );
+    syncCommentEdit();
+}
+
+
+bool MainWindow::removeTableRow( int row )
+{
+    mainTable->blockSignals( true );
+    const bool removed = mainTable->model()->removeRow( row );
+    mainTable->blockSignals( false );
+
+    if( !removed )
+        return false;
+
+    commentStorage.remove( row );
+
+    if( rowSources[row] != storageEngine->data.end() )
+        deletedSources.push_back( rowSources[row] );
+
+    rowSources.remove( row );
+    idRows[rowIds[row]] = -1;
+    rowIds.remove( row );
+    indexRows( row );
+
+    for( int i = 0; i < SORTABLE_COLUMNS_COUNT; ++i )
+        if( row < sortKeys[i].size() )
+            sortKeys[i].remove( row );
+
+    // Rows below the deleted one move up by one
+    std::set<int> shiftedRows;
+    for( std::set<int>::iterator i = dirtyRows.upper_bound( row ); i != dirtyRows.end(); ++i )
+        shiftedRows.insert( shiftedRows.end(), *i - 1 );
+
+    dirtyRows.erase( dirtyRows.lower_bound( row ), dirtyRows.end() );
+    dirtyRows.insert( shiftedRows.begin(), shiftedRows.end() );
+
+    dataChanged = true;
+    syncCommentEdit();
+
+    return true;
+}
+
+
+// Rows from first on have moved, undo and redo find them by identity
+void MainWindow::indexRows( int first )
+{
+    for( int row = first; row < rowIds.size(); ++row )
+        idRows[rowIds[row]] = row;
+}
+
+
 void MainWindow::closeButtonEvent( QAbstractButton *button )
 {
     if( closeButtonBox->buttonRole( button ) == QDialogButtonBox::ApplyRole )
@@ -308,11 +880,17 @@ void MainWindow::editCellEvent( int row, int column )
     if( mainTable->rowCount() - 1 == row )
     {
         commentStorage.resize( row + 1 );
+        rowSources.push_back( storageEngine->data.end() );
+        rowIds.push_back( nextRowId++ );
+        idRows.push_back( row );
         mainTable->setRowCount( row + 2 );
         commentEdit->setEnabled( true );
     }
 
-    dataChanged = true;
+    if( column < SORTABLE_COLUMNS_COUNT && row < sortKeys[column].size() )
+        sortKeys[column][row] = QByteArray();
+
+    markRowDirty( row );
 }
 
 
@@ -321,16 +899,30 @@ void MainWindow::changeCellEvent( int newRow, int newCol, int oldRow, int oldCol
     if( newRow == oldRow )
         return;
 
-    if( oldRow >= 0 && oldRow < commentStorage.size()
-        && commentEdit->document()->isModified() )
+    if( revealedRow >= 0 )
     {
-        commentStorage[oldRow] = commentEdit->toPlainText();
-        dataChanged = true;
+        // Leaving the row hides its password again
+        const int row = revealedRow;
+        revealedRow = -1;
+
+        // Drop the decoded copy unless it is an unsaved edit
+        QTableWidgetItem *item = mainTable->item( row, PASSWORD_COLUMN );
+        if( NULL != item && row < rowSources.size() && rowSources[row] != storageEngine->data.end()
+            && rowSources[row]->cells[PASSWORD_COLUMN] == item->text().toUtf8() )
+        {
+            mainTable->blockSignals( true );
+            delete mainTable->takeItem( row, PASSWORD_COLUMN );
+            mainTable->blockSignals( false );
+        }
+
+        mainTable->viewport()->update();
     }
 
+    commitComment( oldRow );
+
     if( newRow >= 0 && newRow < commentStorage.size() )
     {
-        commentEdit->document()->setPlainText( commentStorage[newRow] );
+        commentEdit->document()->setPlainText( QString::fromUtf8( commentStorage[newRow] ) );
         commentEdit->document()->setModified( false );
         commentEdit->setEnabled( true );
     }
@@ -342,6 +934,46 @@ void MainWindow::changeCellEvent( int newRow, int newCol, int oldRow, int oldCol
 }
 
 
+void MainWindow::sortTable( int column )
+{
+    QHeaderView *header = mainTable->horizontalHeader();
+
+    // Passwords are never decoded for sorting
+    if( column >= 0 && column < SORTABLE_COLUMNS_COUNT )
+    {
+        if( column == sortColumn && Qt::AscendingOrder == sortOrder )
+            sortOrder = Qt::DescendingOrder;
+        else
+            sortOrder = Qt::AscendingOrder;
+
+        sortColumn = column;
+
+        // Pending comment edit belongs to the current entry, wherever it moves
+        commitComment( mainTable->currentRow() );
+
+        const int rowCount = rowSources.size();
+        QVector<QByteArray> &keys = sortKeys[column];
+        keys.resize( rowCount );
+
+        for( int row = 0; row < rowCount; ++row )
+            if( keys[row].isNull() )
+                keys[row] = collationKey( row, column );
+
+        QVector<int> order( rowCount );
+        for( int row = 0; row < rowCount; ++row )
+            order[row] = row;
+
+        std::stable_sort( order.begin(), order.end(),
+                          CollationKeyLess( keys, Qt::DescendingOrder == sortOrder ) );
+
+        applyRowOrder( order );
+    }
+
+    header->setSortIndicatorShown( sortColumn >= 0 );
+    header->setSortIndicator( sortColumn, sortOrder );
+}
+
+
 void MainWindow::tableContextMenuEvent( const QPoint &pos )
 {
     const int curRow = mainTable->currentRow();
@@ -352,7 +984,7 @@ void MainWindow::tableContextMenuEvent( const QPoint &pos )
 
     QAction *deleteAction = ctxMenu.addAction( "Delete row" );
     deleteAction->setShortcut( QString( SHORTCUT_DELETE_ROW ) );
-    deleteAction->setData( -1 );
+    deleteAction->setData( CMA_DELETE_ROW );
 
     ctxMenu.addSeparator();
 
@@ -373,6 +1005,16 @@ void MainWindow::tableContextMenuEvent( const QPoint &pos )
 
         case 2: // Password
             {
+                QAction *showAction = ctxMenu.addAction( "Show password" );
+                showAction->setShortcut( QString( SHORTCUT_SHOW_PASSWORD ) );
+                showAction->setData( CMA_SHOW_PASSWORD );
+
+                QAction *copyAction = ctxMenu.addAction( "Copy password" );
+                copyAction->setShortcut( QString( SHORTCUT_COPY_PASSWORD ) );
+                copyAction->setData( CMA_COPY_PASSWORD );
+
+                ctxMenu.addSeparator();
+
                 QMenu *subMenu = ctxMenu.addMenu( "Generate" );
                 subMenu->menuAction()->setShortcut( QString( SHORTCUT_RANDOMIZE ) );
                 subMenu->addAction( "4-digit PIN (Bank cards, SIM-cards, etc.)" )->setData( PRM_PIN_4 );
@@ -382,9 +1024,19 @@ void MainWindow::tableContextMenuEvent( const QPoint &pos )
                 subMenu->addAction( "16-char password (Local computer accounts)" )->setData( PRM_PASS_16 );
                 subMenu->addAction( "32-char password (Disk encryption, Private WiFi, etc.)" )
                     ->setData( PRM_PASS_32 );
+                subMenu->addAction( "12-char password with every char class (Sites with password rules)" )
+                    ->setData( PRM_POLICY_WEB );
+                subMenu->addAction( "16-char password of letters and digits (Symbols not allowed)" )
+                    ->setData( PRM_POLICY_ALNUM );
+                subMenu->addAction( "20-char password with 2+ chars of every class" )->setData( PRM_POLICY_STRONG );
+                subMenu->addAction( "Password by policy..." )->setData( PRM_POLICY_CUSTOM );
                 subMenu->addAction( "128-bit key in hex" )->setData( PRM_KEY_128 );
                 subMenu->addAction( "192-bit key in hex" )->setData( PRM_KEY_192 );
                 subMenu->addAction( "256-bit key in hex" )->setData( PRM_KEY_256 );
+                subMenu->addAction( "256-bit key in base64" )->setData( PRM_KEY_256_BASE64 );
+                subMenu->addAction( "256-bit key in base64url (Tokens, URLs)" )->setData( PRM_KEY_256_BASE64URL );
+                subMenu->addAction( "160-bit key in base32 (One-time password secrets)" )->setData( PRM_KEY_160_BASE32 );
+                subMenu->addAction( "256-bit key in base58" )->setData( PRM_KEY_256_BASE58 );
             }
             break;
 
@@ -397,10 +1049,40 @@ void MainWindow::tableContextMenuEvent( const QPoint &pos )
         return;
 
     const int option = selectedAction->data().toInt();
-    if( -1 == option )
+    if( CMA_DELETE_ROW == option )
         deleteRow();
+    else if( CMA_SHOW_PASSWORD == option )
+        revealPassword();
+    else if( CMA_COPY_PASSWORD == option )
+        copyPassword();
     else
     {
+        if( mainTable->currentColumn() == 2 && PRM_POLICY_CUSTOM == option )
+        {
+            bool accepted;
+            const QString spec = QInputDialog::getText( this, "Password policy",
+                                                        "Length and policy: presets \"web\", \"alnum\", \"strong\",\n"
+                                                        "or classes u, l, d, s with minimal counts and\n"
+                                                        "forbidden chars after a colon, e.g. \"16 u1l1d1s1:0O\"",
+                                                        QLineEdit::Normal, QString::fromUtf8( passwordPolicySpec.constData() ),
+                                                        &accepted );
+            if( !accepted )
+                return;
+
+            PasswordPolicy policy;
+            if( !parsePolicySpec( spec.toUtf8(), &policy ) )
+            {
+                QMessageBox message( QMessageBox::Warning, "Password policy",
+                                     QString( "Policy \"%1\" is invalid or cannot be satisfied,\n"
+                                              "passwords are at most %2 chars long" ).arg( spec ).arg( POLICY_MAX_LENGTH ),
+                                     QMessageBox::Ok, QApplication::activeWindow() );
+                message.exec();
+                return;
+            }
+
+            passwordPolicySpec = spec.toUtf8();
+        }
+
         if( mainTable->currentColumn() == 2 )
             curPassRandMode = option;
 
@@ -437,8 +1119,16 @@ void MainWindow::deleteRow( bool )
     if( message.exec() != QMessageBox::Yes )
         return;
 
-    if( mainTable->model()->removeRow( row ) )
-        commentStorage.remove( row );
+    commitComment( row );
+
+    EditStep step;
+    step.kind = ESK_DELETE_ROW;
+    step.rowId = rowIds[row];
+    step.row = row;
+    step.before = rowContent( row );
+
+    if( removeTableRow( row ) )
+        history.push( step );
 }
 
 
@@ -449,7 +1139,10 @@ void MainWindow::randomizeCell( bool )
         return;
 
     const int col = mainTable->currentColumn();
+    const uint64_t drawnBefore = Randomizer::bitsDrawn();
     std::string randomized;
+    OutputEntropy entropy;
+    double information;
 
     if( 2 == col )
     {
@@ -463,22 +1156,161 @@ void MainWindow::randomizeCell( bool )
             case PRM_KEY_128: randomized = Randomizer::makeHexBlock( 16 ); break;
             case PRM_KEY_192: randomized = Randomizer::makeHexBlock( 24 ); break;
             case PRM_KEY_256: randomized = Randomizer::makeHexBlock( 32 ); break;
+            case PRM_KEY_256_BASE64:    randomized = Randomizer::makeKey( 32, KE_BASE64 );    break;
+            case PRM_KEY_256_BASE64URL: randomized = Randomizer::makeKey( 32, KE_BASE64URL ); break;
+            case PRM_KEY_160_BASE32:    randomized = Randomizer::makeKey( 20, KE_BASE32 );    break;
+            case PRM_KEY_256_BASE58:    randomized = Randomizer::makeKey( 32, KE_BASE58 );    break;
+            case PRM_POLICY_WEB:    randomized = Randomizer::makePassword( presetPolicyTable<policyWeb>() );    break;
+            case PRM_POLICY_ALNUM:  randomized = Randomizer::makePassword( presetPolicyTable<policyAlnum>() );  break;
+            case PRM_POLICY_STRONG: randomized = Randomizer::makePassword( presetPolicyTable<policyStrong>() ); break;
+            case PRM_POLICY_CUSTOM:
+                {
+                    PasswordPolicy policy;
+                    if( !parsePolicySpec( passwordPolicySpec, &policy ) )
+                        return;
+
+                    const PolicyTable table( policy );
+                    randomized = Randomizer::makePassword( table );
+                    entropy = Randomizer::passwordEntropy( table );
+                }
+                break;
             default: return;
         }
+
+        if( PRM_POLICY_CUSTOM != curPassRandMode )
+            entropy = passwordModeEntropy( curPassRandMode );
+
+        // Every allowed password is equally likely, so this is exact
+        information = entropy.minBits;
     }
     else
     {
         randomized =  Randomizer::makeName( RANDOM_NAMELEN_RANGE );
+        entropy = Randomizer::nameEntropy( RANDOM_NAMELEN_RANGE );
+        information = Randomizer::nameInformation( randomized.data(), randomized.size(), RANDOM_NAMELEN_RANGE );
 
         if( 0 == col )
         {
-            const int domainNo = Randomizer::makeNumber( sizeof(randomDomainSet) / sizeof(randomDomainSet[0]) - 1 );
+            const int domainCount = sizeof(randomDomainSet) / sizeof(randomDomainSet[0]) - 1;
+            const int domainNo = Randomizer::makeNumber( domainCount );
             randomized.append( randomDomainSet[domainNo] );
+
+            information += log2( (double)domainCount );
+            entropy.shannonBits += log2( (double)domainCount );
+            entropy.minBits += log2( (double)domainCount );
         }
     }
 
+    const QString strength = QString( "This value: %1 bits of information, %2 random bits drawn\n"
+                                      "Generator: %3%4 bits Shannon entropy, %3%5 bits min-entropy" )
+                             .arg( information, 0, 'f', 1 )
+                             .arg( (qulonglong)( Randomizer::bitsDrawn() - drawnBefore ) )
+                             .arg( entropy.exact ? "" : "at most " )
+                             .arg( entropy.shannonBits, 0, 'f', 1 )
+                             .arg( entropy.minBits, 0, 'f', 1 );
+
+    beginRowChange( row );
+
     if( NULL == mainTable->item( row, col ) )
         mainTable->setItem( row, col, new QTableWidgetItem( QString::fromStdString( randomized ) ) );
     else
         mainTable->item( row, col )->setText( QString::fromStdString( randomized ) );
+
+    mainTable->item( row, col )->setToolTip( strength );
+
+    endRowChange();
+
+    if( PASSWORD_COLUMN == col )
+    {
+        // Let the user see what has been generated
+        revealedRow = row;
+        mainTable->viewport()->update();
+    }
+}
+
+
+void MainWindow::revealPassword( bool )
+{
+    const int row = mainTable->currentRow();
+    if( !mainTable->hasFocus() || row < 0 || row >= mainTable->rowCount() - 1 )
+        return;
+
+    if( NULL == mainTable->item( row, PASSWORD_COLUMN ) && hasPassword( row ) )
+    {
+        // Materialize the secret without marking the row as edited
+        mainTable->blockSignals( true );
+        mainTable->setItem( row, PASSWORD_COLUMN, new QTableWidgetItem( passwordText( row ) ) );
+        mainTable->blockSignals( false );
+    }
+
+    revealedRow = row;
+    mainTable->viewport()->update();
+}
+
+
+void MainWindow::copyPassword( bool )
+{
+    const int row = mainTable->currentRow();
+    if( !mainTable->hasFocus() || row < 0 || row >= mainTable->rowCount() - 1 )
+        return;
+
+    QApplication::clipboard()->setText( passwordText( row ) );
+}
+
+
+void MainWindow::undo( bool )
+{
+    commitComment( mainTable->currentRow() );
+
+    const EditStep *step = history.undo();
+    if( NULL == step )
+        return;
+
+    const int row = idRows.value( step->rowId, -1 );
+
+    switch( step->kind )
+    {
+        case ESK_CHANGE_ROW:
+                if( row >= 0 )
+                    setRowContent( row, step->before );
+            break;
+
+        case ESK_INSERT_ROW:
+                if( row >= 0 )
+                    removeTableRow( row );
+            break;
+
+        case ESK_DELETE_ROW:
+                insertTableRow( qMin( step->row, rowIds.size() ), step->rowId, step->before );
+            break;
+    }
+}
+
+
+void MainWindow::redo( bool )
+{
+    commitComment( mainTable->currentRow() );
+
+    const EditStep *step = history.redo();
+    if( NULL == step )
+        return;
+
+    const int row = idRows.value( step->rowId, -1 );
+
+    switch( step->kind )
+    {
+        case ESK_CHANGE_ROW:
+                if( row >= 0 )
+                    setRowContent( row, step->after );
+            break;
+
+        case ESK_INSERT_ROW:
+                insertTableRow( qMin( step->row, rowIds.size() ), step->rowId, step->after );
+            break;
+
+        case ESK_DELETE_ROW:
+                if( row >= 0 )
+                    removeTableRow( row );
+            break;
+    }
 }
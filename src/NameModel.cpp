@@ -0,0 +1,285 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "NameModel.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#define NAME_MODEL_MAGIC    "DSNM"
+#define NAME_MODEL_VERSION  1
+
+
+struct NameModelHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t order;
+    uint32_t stateCount;
+    uint8_t reserved[48];  // Keeps the tables 64-byte aligned
+};
+
+static_assert( sizeof(NameModelHeader) == 64, "Name model header must be a cache line" );
+
+
+static uint32_t stateCountOf( int order )
+{
+    uint32_t count = 1;
+    for( int i = 0; i < order; ++i )
+        count *= NAME_MODEL_SYMBOLS;
+
+    return count;
+}
+
+
+NameModel::NameModel()
+: mapping( NULL )
+, mappingSize( 0 )
+, tables( NULL )
+, stateCount( 0 )
+{
+}
+
+
+NameModel::~NameModel()
+{
+    if( NULL != mapping )
+        munmap( (void*)mapping, mappingSize );
+}
+
+
+NameModel *NameModel::open( const char *path )
+{
+    const int fd = ::open( path, O_RDONLY | O_CLOEXEC );
+    if( fd < 0 )
+        return NULL;
+
+    struct stat info;
+    if( fstat( fd, &info ) != 0 )
+    {
+        const int error = errno;
+        close( fd );
+        errno = error;
+        return NULL;
+    }
+
+    if( (size_t)info.st_size < sizeof(NameModelHeader) )
+    {
+        close( fd );
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void *data = mmap( NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    const int error = errno;
+    close( fd );
+
+    if( MAP_FAILED == data )
+    {
+        errno = error;
+        return NULL;
+    }
+
+    NameModel *model = new NameModel();
+    model->mapping = data;
+    model->mappingSize = info.st_size;
+
+    const NameModelHeader *header = (const NameModelHeader*)data;
+    bool valid = memcmp( header->magic, NAME_MODEL_MAGIC, sizeof(header->magic) ) == 0 &&
+                 NAME_MODEL_VERSION == header->version &&
+                 header->order >= 1 && header->order <= NAME_MODEL_MAX_ORDER &&
+                 stateCountOf( header->order ) == header->stateCount &&
+                 (size_t)info.st_size == sizeof(*header) + (size_t)header->stateCount * ALIAS_MAX_COLUMNS * sizeof(uint32_t);
+
+    if( valid )
+    {
+        model->tables = (const uint32_t*)( header + 1 );
+        model->stateCount = header->stateCount;
+
+        // A damaged table must not yield anything but a letter or the end
+        const uint32_t capacity = (uint32_t)1 << NAME_MODEL_SHIFT;
+        for( size_t i = 0; valid && i < (size_t)model->stateCount * ALIAS_MAX_COLUMNS; ++i )
+        {
+            const uint32_t threshold = model->tables[i] & ALIAS_THRESHOLD_MASK;
+            valid = threshold <= capacity &&
+                    ( threshold == capacity || ( model->tables[i] >> ALIAS_WEIGHT_BITS ) < NAME_MODEL_SYMBOLS ) &&
+                    ( threshold == 0 || i % ALIAS_MAX_COLUMNS < NAME_MODEL_SYMBOLS );
+        }
+    }
+
+    if( !valid )
+    {
+        delete model;
+        errno = EINVAL;
+        return NULL;
+    }
+
+    madvise( data, info.st_size, MADV_WILLNEED );
+    return model;
+}
+
+
+bool NameModel::endsOnly( uint32_t state ) const
+{
+    const uint32_t *column = columns( state );
+
+    for( int i = 0; i < ALIAS_MAX_COLUMNS; ++i )
+    {
+        const uint32_t threshold = column[i] & ALIAS_THRESHOLD_MASK;
+        const int alias = column[i] >> ALIAS_WEIGHT_BITS;
+
+        if( ( threshold > 0 && i != NAME_MODEL_END ) ||
+            ( threshold < ( (uint32_t)1 << NAME_MODEL_SHIFT ) && alias != NAME_MODEL_END ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool NameModel::train( const char *corpusPath, const char *modelPath, int order )
+{
+    if( order < 1 || order > NAME_MODEL_MAX_ORDER )
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    FILE *corpus = fopen( corpusPath, "r" );
+    if( NULL == corpus )
+        return false;
+
+    const uint32_t stateCount = stateCountOf( order );
+    std::vector<uint64_t> counts( (size_t)stateCount * NAME_MODEL_SYMBOLS );
+
+    uint32_t state = stateCount - 1;
+    bool inName = false;
+    int c;
+
+    do
+    {
+        c = getc( corpus );
+
+        if( ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) )
+        {
+            const int letter = ( c | 0x20 ) - 'a';
+
+            counts[(size_t)state * NAME_MODEL_SYMBOLS + letter]++;
+            state = ( state * NAME_MODEL_SYMBOLS + letter ) % stateCount;
+            inName = true;
+        }
+        else if( inName )
+        {
+            counts[(size_t)state * NAME_MODEL_SYMBOLS + NAME_MODEL_END]++;
+            state = stateCount - 1;
+            inName = false;
+        }
+    }
+    while( EOF != c );
+
+    const bool readOk = !ferror( corpus );
+    fclose( corpus );
+
+    if( !readOk )
+    {
+        errno = EIO;
+        return false;
+    }
+
+    FILE *out = fopen( modelPath, "wb" );
+    if( NULL == out )
+        return false;
+
+    NameModelHeader header;
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, NAME_MODEL_MAGIC, sizeof(header.magic) );
+    header.version = NAME_MODEL_VERSION;
+    header.order = order;
+    header.stateCount = stateCount;
+
+    bool ok = fwrite( &header, sizeof(header), 1, out ) == 1;
+
+    for( uint32_t i = 0; ok && i < stateCount; ++i )
+    {
+        const uint64_t *stateCounts = &counts[(size_t)i * NAME_MODEL_SYMBOLS];
+        uint32_t weights[NAME_MODEL_SYMBOLS] = {};
+        uint64_t total = 0;
+
+        for( int j = 0; j < NAME_MODEL_SYMBOLS; ++j )
+            total += stateCounts[j];
+
+        if( 0 == total )
+        {
+            // Never reached by generation
+            weights[NAME_MODEL_END] = (uint32_t)1 << ALIAS_WEIGHT_BITS;
+        }
+        else
+        {
+            // Scale to 2**24 keeping every seen symbol, the most likely one takes the rounding
+            uint32_t sum = 0;
+            int top = 0;
+
+            for( int j = 0; j < NAME_MODEL_SYMBOLS; ++j )
+            {
+                if( stateCounts[j] > 0 )
+                {
+                    weights[j] = (uint32_t)( ( stateCounts[j] << ALIAS_WEIGHT_BITS ) / total );
+                    if( 0 == weights[j] )
+                        weights[j] = 1;
+                }
+
+                sum += weights[j];
+                if( weights[j] > weights[top] )
+                    top = j;
+            }
+
+            weights[top] += ( (uint32_t)1 << ALIAS_WEIGHT_BITS ) - sum;
+        }
+
+        uint32_t columns[ALIAS_MAX_COLUMNS] = {};
+        buildAliasColumns( columns, weights, NAME_MODEL_SYMBOLS );
+
+        ok = aliasColumnsExact( columns, weights, NAME_MODEL_SYMBOLS ) &&
+             fwrite( columns, sizeof(columns), 1, out ) == 1;
+    }
+
+    const bool closed = ( fclose( out ) == 0 );
+
+    if( !ok || !closed )
+    {
+        unlink( modelPath );
+        errno = EIO;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,222 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "PasswordPolicy.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
+
+static const char classLetters[CC_COUNT + 1] = "ulds";
+
+static const struct
+{
+    const char *name;
+    const PasswordPolicy *policy;
+} policyPresets[] = {
+    { "web",    &policyWeb },
+    { "alnum",  &policyAlnum },
+    { "strong", &policyStrong }
+};
+
+
+bool PasswordPolicy::parse( const char *spec, PasswordPolicy *dst )
+{
+    const char *colon = strchr( spec, ':' );
+    const std::string classSpec( spec, ( NULL != colon ) ? colon - spec : strlen( spec ) );
+
+    PasswordPolicy policy = *dst;
+    policy.forbidden = ( NULL != colon ) ? colon + 1 : NULL;
+
+    for( size_t i = 0; i < sizeof(policyPresets) / sizeof(policyPresets[0]); ++i )
+        if( strcasecmp( classSpec.c_str(), policyPresets[i].name ) == 0 )
+        {
+            const PasswordPolicy *preset = policyPresets[i].policy;
+
+            policy.minLength = preset->minLength;
+            policy.maxLength = preset->maxLength;
+            policy.classes = preset->classes;
+            memcpy( policy.required, preset->required, sizeof(policy.required) );
+
+            *dst = policy;
+            return true;
+        }
+
+    policy.classes = 0;
+    memset( policy.required, 0, sizeof(policy.required) );
+
+    for( const char *c = classSpec.c_str(); *c != '\0'; )
+    {
+        const char *letter = strchr( classLetters, *c );
+        if( NULL == letter )
+            return false;
+
+        const int charClass = letter - classLetters;
+        if( policy.classes & CC_MASK( charClass ) )
+            return false;
+
+        policy.classes |= CC_MASK( charClass );
+
+        char *end;
+        const long count = strtol( ++c, &end, 10 );
+        if( end != c )
+        {
+            if( count < 0 || count > POLICY_MAX_LENGTH )
+                return false;
+
+            policy.required[charClass] = count;
+            c = end;
+        }
+    }
+
+    if( 0 == policy.classes )
+        return false;
+
+    *dst = policy;
+    return true;
+}
+
+
+PolicyTable::PolicyTable( const PasswordPolicy &policy )
+: rules( policy )
+{
+    if( !rules.isValid() )
+        return;
+
+    for( int i = 0; i < CC_COUNT; ++i )
+    {
+        if( !( rules.classes & CC_MASK( i ) ) )
+            continue;
+
+        for( const char *c = charClassSets[i]; *c != '\0'; ++c )
+            if( NULL == rules.forbidden || NULL == strchr( rules.forbidden, *c ) )
+                alphabets[i].push_back( *c );
+    }
+
+    // Forbidden chars are kept in the alphabets only
+    rules.forbidden = NULL;
+
+    BN_CTX *ctx = BN_CTX_new();
+    std::vector<BIGNUM*> factorials( rules.maxLength + 1 );
+    bool ok = ( NULL != ctx );
+
+    for( int i = 0; i <= rules.maxLength; ++i )
+    {
+        factorials[i] = BN_new();
+        ok = ok && NULL != factorials[i] && BN_set_word( factorials[i], 1 ) &&
+             ( 0 == i || ( BN_copy( factorials[i], factorials[i - 1] ) && BN_mul_word( factorials[i], i ) ) );
+    }
+
+    BIGNUM *total = BN_new();
+    BIGNUM *count = BN_new();
+    ok = ok && NULL != total && NULL != count;
+
+    // One running total over all lengths, so a single draw picks both length and composition
+    BN_zero( total );
+
+    for( int length = rules.minLength; ok && length <= rules.maxLength; ++length )
+    {
+        LengthTable table;
+        table.length = length;
+        table.first = compositions.size() / CC_COUNT;
+
+        uint8_t counts[CC_COUNT];
+        addCompositions( 0, length, counts );
+
+        table.count = compositions.size() / CC_COUNT - table.first;
+
+        // Passwords of a composition: multinomial( length; counts ) * product of size**count
+        for( size_t i = table.first; ok && i < table.first + table.count; ++i )
+        {
+            const uint8_t *composition = &compositions[i * CC_COUNT];
+
+            ok = ( NULL != BN_copy( count, factorials[length] ) );
+            for( int j = 0; ok && j < CC_COUNT; ++j )
+            {
+                ok = BN_div( count, NULL, count, factorials[composition[j]], ctx );
+                for( int k = 0; ok && k < composition[j]; ++k )
+                    ok = BN_mul_word( count, alphabets[j].size() );
+            }
+
+            BIGNUM *bound = NULL;
+            ok = ok && BN_add( total, total, count ) && NULL != ( bound = BN_dup( total ) );
+            if( ok )
+                bounds.push_back( bound );
+        }
+
+        lengths.push_back( table );
+    }
+
+    if( !ok )
+        lengths.clear();
+
+    BN_free( count );
+    BN_free( total );
+
+    for( size_t i = 0; i < factorials.size(); ++i )
+        BN_free( factorials[i] );
+
+    BN_CTX_free( ctx );
+}
+
+
+PolicyTable::~PolicyTable()
+{
+    for( size_t i = 0; i < bounds.size(); ++i )
+        BN_free( bounds[i] );
+}
+
+
+bool PolicyTable::isValid() const
+{
+    return !lengths.empty();
+}
+
+
+int PolicyTable::maxLength() const
+{
+    return rules.maxLength;
+}
+
+
+void PolicyTable::addCompositions( int charClass, int left, uint8_t *counts )
+{
+    if( CC_COUNT == charClass )
+    {
+        if( 0 == left )
+            compositions.insert( compositions.end(), counts, counts + CC_COUNT );
+
+        return;
+    }
+
+    // Classes without chars left take no slots
+    const int most = alphabets[charClass].empty() ? 0 : left;
+
+    for( int count = rules.required[charClass]; count <= most; ++count )
+    {
+        counts[charClass] = count;
+        addCompositions( charClass + 1, left - count, counts );
+    }
+}
@@ -23,13 +23,198 @@
  */
 
 #include "Randomizer.h"
+#include "AliasTable.h"
 
-#include <openssl/rand.h>
+#include <math.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/sha.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PASSWORD_MAP_X86
+#endif
+
+// The bulk password path reads the bit stream bytewise
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define PASSWORD_MAP_BULK
+#endif
+
+#define DEFAULT_ENTROPY_BACKEND EB_OPENSSL
+
+#define PASSWORD_BATCH_CHARS 3072
+#define KEY_STACK_BYTES      256
+#define BIG_UNIFORM_BYTES    64
+
+// Wider words considered by getUniform() to lower the rejection rate
+#define UNIFORM_EXTRA_BITS   4
+
+// Backend for Randomizer instances of threads started later
+static std::atomic<int> defaultBackend( DEFAULT_ENTROPY_BACKEND );
+
+// Deterministic mode key, set by setSeed() before generating threads start
+static uint8_t seedKey[SEED_KEY_SIZE];
+static std::atomic<bool> seeded( false );
 
 // Let's exclude letters looking similar to digits and add some symbols...
 static const char passwordCharSet[64+1] = "ACDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnpqrstuvwxyz0123456789#*?:+=_";
 
-static const char hexCharSet[16+1] = "0123456789abcdef";
+/*
+ * Bulk password mapping: every 3 random bytes form 4 password chars, taking
+ * 6-bit indices LSB first, exactly as consecutive getBits( 6 ) calls do.
+ * Vector versions spread 3 bytes to a 32-bit lane, split it into 4 index
+ * bytes and look the chars up with 4 pshufb over 16-char slices of the set.
+ */
+typedef void (*PasswordMapFn)( char *dst, const uint8_t *src, size_t groups );
+
+static void mapPasswordGroupsScalar( char *dst, const uint8_t *src, size_t groups )
+{
+    for( size_t i = 0; i < groups; ++i, src += 3, dst += 4 )
+    {
+        const uint32_t v = src[0] | ( src[1] << 8 ) | ( src[2] << 16 );
+
+        dst[0] = passwordCharSet[v & 63];
+        dst[1] = passwordCharSet[( v >> 6 ) & 63];
+        dst[2] = passwordCharSet[( v >> 12 ) & 63];
+        dst[3] = passwordCharSet[v >> 18];
+    }
+}
+
+#ifdef PASSWORD_MAP_X86
+
+__attribute__((target("ssse3")))
+static void mapPasswordGroupsSsse3( char *dst, const uint8_t *src, size_t groups )
+{
+    const __m128i spread = _mm_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1 );
+    const __m128i lowNibble = _mm_set1_epi8( 0x0F );
+    __m128i slices[4];
+    size_t i = 0;
+
+    for( int k = 0; k < 4; ++k )
+        slices[k] = _mm_loadu_si128( (const __m128i*)( passwordCharSet + 16 * k ) );
+
+    // 16 bytes are loaded for every 12 consumed, stay inside of src
+    for( ; i + 6 <= groups; i += 4 )
+    {
+        const __m128i v = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)( src + 3 * i ) ), spread );
+
+        const __m128i index = _mm_or_si128(
+            _mm_or_si128( _mm_and_si128( v, _mm_set1_epi32( 0x3F ) ),
+                          _mm_and_si128( _mm_slli_epi32( v, 2 ), _mm_set1_epi32( 0x3F00 ) ) ),
+            _mm_or_si128( _mm_and_si128( _mm_slli_epi32( v, 4 ), _mm_set1_epi32( 0x3F0000 ) ),
+                          _mm_and_si128( _mm_slli_epi32( v, 6 ), _mm_set1_epi32( 0x3F000000 ) ) ) );
+
+        const __m128i low = _mm_and_si128( index, lowNibble );
+        const __m128i high = _mm_and_si128( _mm_srli_epi16( index, 4 ), lowNibble );
+
+        __m128i res = _mm_setzero_si128();
+        for( int k = 0; k < 4; ++k )
+            res = _mm_or_si128( res, _mm_and_si128( _mm_shuffle_epi8( slices[k], low ),
+                                                    _mm_cmpeq_epi8( high, _mm_set1_epi8( k ) ) ) );
+
+        _mm_storeu_si128( (__m128i*)( dst + 4 * i ), res );
+    }
+
+    mapPasswordGroupsScalar( dst + 4 * i, src + 3 * i, groups - i );
+}
+
+
+__attribute__((target("avx2")))
+static void mapPasswordGroupsAvx2( char *dst, const uint8_t *src, size_t groups )
+{
+    const __m256i spread = _mm256_setr_epi8( 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                             0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1 );
+    const __m256i lowNibble = _mm256_set1_epi8( 0x0F );
+    __m256i slices[4];
+    size_t i = 0;
+
+    for( int k = 0; k < 4; ++k )
+        slices[k] = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i*)( passwordCharSet + 16 * k ) ) );
+
+    // Lanes are loaded from src + 3 * i and 12 bytes further, 16 bytes each
+    for( ; i + 10 <= groups; i += 8 )
+    {
+        const __m256i bytes = _mm256_inserti128_si256(
+            _mm256_castsi128_si256( _mm_loadu_si128( (const __m128i*)( src + 3 * i ) ) ),
+            _mm_loadu_si128( (const __m128i*)( src + 3 * i + 12 ) ), 1 );
+        const __m256i v = _mm256_shuffle_epi8( bytes, spread );
+
+        const __m256i index = _mm256_or_si256(
+            _mm256_or_si256( _mm256_and_si256( v, _mm256_set1_epi32( 0x3F ) ),
+                             _mm256_and_si256( _mm256_slli_epi32( v, 2 ), _mm256_set1_epi32( 0x3F00 ) ) ),
+            _mm256_or_si256( _mm256_and_si256( _mm256_slli_epi32( v, 4 ), _mm256_set1_epi32( 0x3F0000 ) ),
+                             _mm256_and_si256( _mm256_slli_epi32( v, 6 ), _mm256_set1_epi32( 0x3F000000 ) ) ) );
+
+        const __m256i low = _mm256_and_si256( index, lowNibble );
+        const __m256i high = _mm256_and_si256( _mm256_srli_epi16( index, 4 ), lowNibble );
+
+        __m256i res = _mm256_setzero_si256();
+        for( int k = 0; k < 4; ++k )
+            res = _mm256_or_si256( res, _mm256_and_si256( _mm256_shuffle_epi8( slices[k], low ),
+                                                          _mm256_cmpeq_epi8( high, _mm256_set1_epi8( k ) ) ) );
+
+        _mm256_storeu_si256( (__m256i*)( dst + 4 * i ), res );
+    }
+
+    mapPasswordGroupsSsse3( dst + 4 * i, src + 3 * i, groups - i );
+}
+
+#endif // PASSWORD_MAP_X86
+
+
+/*
+ * Copy of a short item. GCC expands memcpy() of unknown size to "rep movs",
+ * whose setup costs more than generating the item, so typical sizes are
+ * copied with two overlapping fixed-size moves.
+ */
+static inline void copyChars( char *dst, const char *src, size_t count )
+{
+    if( count >= 16 && count <= 32 )
+    {
+        memcpy( dst, src, 16 );
+        memcpy( dst + count - 16, src + count - 16, 16 );
+    }
+    else if( count >= 8 && count < 16 )
+    {
+        memcpy( dst, src, 8 );
+        memcpy( dst + count - 8, src + count - 8, 8 );
+    }
+    else if( count >= 4 && count < 8 )
+    {
+        memcpy( dst, src, 4 );
+        memcpy( dst + count - 4, src + count - 4, 4 );
+    }
+    else
+    {
+        memcpy( dst, src, count );
+    }
+}
+
+
+static PasswordMapFn selectPasswordMapper()
+{
+#ifdef PASSWORD_MAP_X86
+    __builtin_cpu_init();
+
+    if( __builtin_cpu_supports( "avx2" ) )
+        return &mapPasswordGroupsAvx2;
+
+    if( __builtin_cpu_supports( "ssse3" ) )
+        return &mapPasswordGroupsSsse3;
+#endif
+
+    return &mapPasswordGroupsScalar;
+}
+
+
+static void mapPasswordGroups( char *dst, const uint8_t *src, size_t groups )
+{
+    static const PasswordMapFn impl = selectPasswordMapper();
+    impl( dst, src, groups );
+}
 
 /*
  * +----------------------------------------------+
@@ -54,11 +239,11 @@ struct LitInfo
 {
     char value[3];
     char canDup;     // Can be duplicated, as "ee" or "rr" but not "uu"
-    uint32_t weight; // Sum of literal weights must be 2**24
+    uint32_t weight; // Sum of literal weights must be 2**24, checked at compile time
 };
 
 
-static const LitInfo vowelSet[] = {
+static constexpr LitInfo vowelSet[] = {
     { "e", 1, 5040273 },
     { "a", 0, 3406646 },
     { "o", 1, 3221018 },
@@ -67,7 +252,7 @@ static const LitInfo vowelSet[] = {
     { "y", 0, 886281 }
 };
 
-static const LitInfo consonantSet[] = {
+static constexpr LitInfo consonantSet[] = {
     { "n",  1, 1965342 },
     { "r",  1, 1703266 },
     { "t",  0, 1674560 },
@@ -94,7 +279,7 @@ static const LitInfo consonantSet[] = {
     { "z",  0, 19861 }
 };
 
-static const LitInfo wordEndSet[] = {
+static constexpr LitInfo wordEndSet[] = {
     { "" ,  0, 4194304 },
     { "t",  0, 1331525 },
     { "s",  0, 1249585 },
@@ -116,213 +301,1397 @@ static const LitInfo wordEndSet[] = {
 };
 
 
+/*
+ * Literal sets are sampled with alias tables, built and checked at compile
+ * time. The vowel table with its header fits a single cache line.
+ */
+struct alignas(64) LitTable
+{
+    const LitInfo *literals;
+    int shift;                           // Draw bits below the column index
+    uint32_t columns[ALIAS_MAX_COLUMNS];
+};
+
+
+template<size_t N>
+static constexpr uint32_t litWeightSum( const LitInfo (&literals)[N] )
+{
+    uint32_t sum = 0;
+    for( size_t i = 0; i < N; ++i )
+        sum += literals[i].weight;
+
+    return sum;
+}
+
+
+template<size_t N>
+static constexpr LitTable makeLitTable( const LitInfo (&literals)[N] )
+{
+    uint32_t weights[N] = {};
+    for( size_t i = 0; i < N; ++i )
+        weights[i] = literals[i].weight;
+
+    LitTable table = {};
+    table.literals = literals;
+    table.shift = ALIAS_WEIGHT_BITS - aliasColumnBits( N );
+
+    buildAliasColumns( table.columns, weights, N );
+    return table;
+}
+
+
+template<size_t N>
+static constexpr bool litTableExact( const LitTable &table, const LitInfo (&literals)[N] )
+{
+    uint32_t weights[N] = {};
+    for( size_t i = 0; i < N; ++i )
+        weights[i] = literals[i].weight;
+
+    return aliasColumnsExact( table.columns, weights, N );
+}
+
+
+static_assert( sizeof(vowelSet) / sizeof(vowelSet[0]) <= ALIAS_MAX_COLUMNS &&
+               sizeof(consonantSet) / sizeof(consonantSet[0]) <= ALIAS_MAX_COLUMNS &&
+               sizeof(wordEndSet) / sizeof(wordEndSet[0]) <= ALIAS_MAX_COLUMNS,
+               "Too many literals in a set" );
+
+static_assert( litWeightSum( vowelSet ) == ( 1 << ALIAS_WEIGHT_BITS ), "Vowel weights must sum to 2**24" );
+static_assert( litWeightSum( consonantSet ) == ( 1 << ALIAS_WEIGHT_BITS ), "Consonant weights must sum to 2**24" );
+static_assert( litWeightSum( wordEndSet ) == ( 1 << ALIAS_WEIGHT_BITS ), "Word end weights must sum to 2**24" );
+
+static constexpr LitTable vowelTable = makeLitTable( vowelSet );
+static constexpr LitTable consonantTable = makeLitTable( consonantSet );
+static constexpr LitTable wordEndTable = makeLitTable( wordEndSet );
+
+static_assert( litTableExact( vowelTable, vowelSet ), "Bad vowel alias table" );
+static_assert( litTableExact( consonantTable, consonantSet ), "Bad consonant alias table" );
+static_assert( litTableExact( wordEndTable, wordEndSet ), "Bad word end alias table" );
+
+
+static inline char *appendLiteral( char *dst, const LitInfo *literal )
+{
+    for( const char *c = literal->value; *c != '\0'; ++c )
+        *dst++ = *c;
+
+    return dst;
+}
+
+
 Randomizer::Randomizer()
-: poolSize( 0 )
+: reservoir( 0 )
+, reservoirBits( 0 )
+, drawnBits( 0 )
+, uniformRanges()
+, source( seeded ? EntropySource::createSeeded( seedKey, 0 )
+                : EntropySource::create( (EntropyBackend)defaultBackend.load() ) )
+, bufferUsed( RANDOM_BUFFER_SIZE )
+, bufferGeneration( 0 )
+{
+}
+
+
+Randomizer::~Randomizer()
+{
+    // Plain stores to a dying object may be optimized away
+    OPENSSL_cleanse( buffer, sizeof(buffer) );
+    OPENSSL_cleanse( &reservoir, sizeof(reservoir) );
+
+    delete source;
+}
+
+
+bool Randomizer::setBackend( EntropyBackend backend )
+{
+    // Seeded mode cannot be left
+    if( seeded )
+        return false;
+
+    EntropySource *newSource = EntropySource::create( backend );
+    if( NULL == newSource )
+        return false;
+
+    defaultBackend.store( backend );
+    getInstance()->replaceSource( newSource );
+
+    return true;
+}
+
+
+bool Randomizer::setSeed( const void *seed, size_t size )
+{
+    SHA256( (const unsigned char *)seed, size, seedKey );
+    seeded = true;
+
+    return selectStream( 0 );
+}
+
+
+bool Randomizer::isSeeded()
+{
+    return seeded;
+}
+
+
+bool Randomizer::selectStream( uint64_t stream )
+{
+    if( seeded )
+        getInstance()->replaceSource( EntropySource::createSeeded( seedKey, stream ) );
+
+    return seeded;
+}
+
+
+void Randomizer::replaceSource( EntropySource *newSource )
+{
+    delete source;
+    source = newSource;
+
+    // Drop everything buffered from the previous source
+    memset( buffer, 0, sizeof(buffer) );
+    bufferUsed = RANDOM_BUFFER_SIZE;
+    reservoir = 0;
+    reservoirBits = 0;
+}
+
+
+uint32_t Randomizer::makeBits( int count )
 {
+    uint32_t t;
+
+    if( !getInstance()->getBits( &t, count ) )
+        return 0;
+
+    return t;
 }
 
 
 uint32_t Randomizer::makeNumber( uint32_t modulo )
 {
-    Randomizer *randomizer = getInstance();
-    uint64_t t;
+    uint32_t t;
 
-    if( !randomizer->getBits( ((uint32_t*)&t), 32 ) ||
-        !randomizer->getBits( ((uint32_t*)&t) + 1, 32 ) )
-    {
+    if( !getInstance()->getUniform( &t, modulo ) )
         return modulo;
-    }
 
-    return (t % modulo);
+    return t;
 }
 
 
-std::string Randomizer::makePin( int length )
+bool Randomizer::makeBytes( uint8_t *dst, size_t count )
+{
+    Randomizer *randomizer = getInstance();
+
+    // Large blocks are filled by the source in place, not copied through the buffer
+    const bool ok = ( count >= RANDOM_BUFFER_SIZE ) ? randomizer->source->fill( dst, count )
+                                                    : randomizer->getBytes( dst, count );
+    if( !ok )
+        return false;
+
+    randomizer->drawnBits += count * 8;
+    return true;
+}
+
+
+uint64_t Randomizer::bitsDrawn()
 {
-    std::string res;
-    res.reserve( length + 3 );
+    return getInstance()->drawnBits;
+}
 
-    for( int i = 0; i < length; i += 4 )
-    {
-        uint32_t t = makeNumber( 10000 );
-        for( int j = 0; j < 4; ++j )
-        {
-            res.push_back( '0' + (t % 10) );
-            t /= 10;
-        }
-    }
 
-    res.resize( length );
+/*
+ * +----------------------------------------------+
+ * |              Entropy accounting              |
+ * +----------------------------------------------+
+ *
+ * Items of different lengths never coincide, so a uniform length among
+ * k adds log2( k ) bits, and the shortest items are the most probable.
+ *
+ * Syllable names are ambiguous: "ee" is a duplicated vowel or two
+ * syllables with the empty consonant, a trailing "y" is a vowel or a word
+ * end. Their distribution is only bounded by the entropy of the choices
+ * that reach the output. The information of a single name is exact, a
+ * parse over every syllable split. Letter model names are unambiguous and
+ * exact in both ways.
+ */
+
+static double binaryEntropy( double p )
+{
+    return ( p <= 0 || p >= 1 ) ? 0 : -p * log2( p ) - ( 1 - p ) * log2( 1 - p );
+}
+
+
+static OutputEntropy uniformLengths( int minLength, int maxLength, double bitsPerUnit )
+{
+    const double lengthBits = log2( (double)std::max( 1, maxLength - minLength + 1 ) );
+    const OutputEntropy res = { lengthBits + bitsPerUnit * ( minLength + maxLength ) / 2,
+                                lengthBits + bitsPerUnit * minLength, true };
     return res;
 }
 
 
-std::string Randomizer::makePassword( int length )
+static double bnLog2( const BIGNUM *value )
 {
-    Randomizer *randomizer = getInstance();
-    std::string res;
-    uint32_t t;
+    const int bits = BN_num_bits( value );
+    if( bits <= 53 )
+        return log2( (double)BN_get_word( value ) );
 
-    res.reserve( length );
-    for( int i = 0; i < length; ++i )
+    // 53 high bits are all a double holds
+    BIGNUM *high = BN_new();
+    if( NULL == high || !BN_rshift( high, value, bits - 53 ) )
     {
-        if( !randomizer->getBits( &t, 6 ) )
-            return res;
+        BN_free( high );
+        return bits - 1;
+    }
+
+    const double res = log2( (double)BN_get_word( high ) ) + ( bits - 53 );
+    BN_free( high );
+    return res;
+}
+
 
-        res.push_back( passwordCharSet[t] );
+template<size_t N>
+static double literalEntropy( const LitInfo (&set)[N] )
+{
+    double res = 0;
+    for( size_t i = 0; i < N; ++i )
+    {
+        const double p = (double)set[i].weight / ( 1 << ALIAS_WEIGHT_BITS );
+        res -= p * log2( p );
     }
 
     return res;
 }
 
 
-std::string Randomizer::makeHexBlock( int bytes )
+template<size_t N>
+static double literalMaxP( const LitInfo (&set)[N], bool dupAllowed )
 {
-    Randomizer *randomizer = getInstance();
-    std::string res;
-    uint32_t t;
+    // Not duplicating a literal, which may be duplicated, takes 15 of 16 cases
+    double res = 0;
+    for( size_t i = 0; i < N; ++i )
+        res = std::max( res, (double)set[i].weight / ( 1 << ALIAS_WEIGHT_BITS ) *
+                             ( ( dupAllowed && set[i].canDup ) ? 15.0 / 16 : 1.0 ) );
 
-    res.reserve( bytes * 2 );
-    for( int i = 0; i < bytes; ++i )
-    {
-        if( !randomizer->getBits( &t, 8 ) )
-            return res;
+    return res;
+}
 
-        res.push_back( hexCharSet[t & 15] );
-        res.push_back( hexCharSet[t >> 4] );
-    }
+
+template<size_t N>
+static double canDupShare( const LitInfo (&set)[N] )
+{
+    double res = 0;
+    for( size_t i = 0; i < N; ++i )
+        if( set[i].canDup )
+            res += (double)set[i].weight / ( 1 << ALIAS_WEIGHT_BITS );
 
     return res;
 }
 
 
-std::string Randomizer::makeName( int minSyllables, int maxSyllables )
+// Chance of k heads of n fair coin flips, as writeName() counts syllables
+static double binomial( int n, int k )
 {
-    Randomizer *randomizer = getInstance();
-    std::string res;
-    const LitInfo *literal;
-    uint32_t t;
+    double res = 1;
+    for( int i = 0; i < k; ++i )
+        res = res * ( n - i ) / ( i + 1 );
 
-    // Randomize actual syllable count with norm distribution
-    int syllableCount = minSyllables;
-    for( int i = 0; i < maxSyllables - minSyllables; ++i )
+    return res / pow( 2.0, n );
+}
+
+
+static long matchLiteral( const char *name, size_t length, long pos, const LitInfo &literal )
+{
+    const size_t size = strlen( literal.value );
+
+    if( pos + size > length || memcmp( name + pos, literal.value, size ) != 0 )
+        return -1;
+
+    return pos + size;
+}
+
+
+// Probability of syllables first..count - 1 and a word end to give name[pos..]
+static double parseSyllables( const char *name, size_t length, int first, int count, long pos, std::vector<double> *memo )
+{
+    double &known = (*memo)[first * ( length + 1 ) + pos];
+    if( known >= 0 )
+        return known;
+
+    const double unit = 1 << ALIAS_WEIGHT_BITS;
+    double res = 0;
+
+    if( first == count )
     {
-        if( !randomizer->getBits( &t, 1 ) )
-            return res;
+        for( size_t e = 0; e < sizeof(wordEndSet) / sizeof(wordEndSet[0]); ++e )
+            if( matchLiteral( name, length, pos, wordEndSet[e] ) == (long)length )
+                res += wordEndSet[e].weight / unit;
 
-        syllableCount += t;
+        return known = res;
     }
 
-    // Generate syllables
-    for( int i = 0; i < syllableCount; ++i )
+    for( size_t c = 0; c < sizeof(consonantSet) / sizeof(consonantSet[0]); ++c )
     {
-        literal = randomizer->getLiteral( consonantSet, sizeof(consonantSet) );
-        if( NULL == literal || !randomizer->getBits( &t, 4 ) )
-            return res;
+        const LitInfo &consonant = consonantSet[c];
 
-        if( 0 != i || t >= 4 )
-            res += literal->value;
+        // Consonant taken once, twice, or left out of the first syllable
+        long afterConsonant[3] = { -1, -1, -1 };
+        double consonantP[3] = { 0, 0, 0 };
 
-        if( t == 0 && literal->canDup && 0 != i )
+        if( 0 == first )
         {
-            // Consonant duplication
-            res += literal->value;
+            afterConsonant[0] = pos;
+            consonantP[0] = 4.0 / 16;
+            afterConsonant[1] = matchLiteral( name, length, pos, consonant );
+            consonantP[1] = 12.0 / 16;
         }
-        else if( t >= 12 )
+        else
         {
-            // Additional consonant
-            literal = randomizer->getLiteral( consonantSet, sizeof(consonantSet) );
-            if( NULL == literal || !randomizer->getBits( &t, 4 ) )
-                return res;
-        }
+            afterConsonant[1] = matchLiteral( name, length, pos, consonant );
+            consonantP[1] = consonant.canDup ? 15.0 / 16 : 1.0;
 
-        literal = randomizer->getLiteral( vowelSet, sizeof(vowelSet) );
-        if( NULL == literal || !randomizer->getBits( &t, 4 ) )
-            return res;
+            if( consonant.canDup && afterConsonant[1] >= 0 )
+            {
+                afterConsonant[2] = matchLiteral( name, length, afterConsonant[1], consonant );
+                consonantP[2] = 1.0 / 16;
+            }
+        }
 
-        res += literal->value;
-        if( t == 0 && literal->canDup && res.size() > 1 )
+        for( int k = 0; k < 3; ++k )
         {
-            // Vowel duplication
-            res += literal->value;
+            if( afterConsonant[k] < 0 )
+                continue;
+
+            for( size_t v = 0; v < sizeof(vowelSet) / sizeof(vowelSet[0]); ++v )
+            {
+                const LitInfo &vowel = vowelSet[v];
+                const long afterVowel = matchLiteral( name, length, afterConsonant[k], vowel );
+                if( afterVowel < 0 )
+                    continue;
+
+                const double p = consonant.weight / unit * consonantP[k] * vowel.weight / unit;
+
+                // Duplication is checked against the name written so far
+                if( !vowel.canDup || afterVowel <= 1 )
+                {
+                    res += p * parseSyllables( name, length, first + 1, count, afterVowel, memo );
+                    continue;
+                }
+
+                res += p * 15 / 16 * parseSyllables( name, length, first + 1, count, afterVowel, memo );
+
+                const long afterDup = matchLiteral( name, length, afterVowel, vowel );
+                if( afterDup >= 0 )
+                    res += p / 16 * parseSyllables( name, length, first + 1, count, afterDup, memo );
+            }
         }
     }
 
-    // Add some word end
-    literal = randomizer->getLiteral( wordEndSet, sizeof(wordEndSet) );
-    if( NULL != literal )
-        res += literal->value;
-
-    return res;
+    return known = res;
 }
 
 
-bool Randomizer::getBits( uint32_t *dst, int count )
+static const LitInfo *literalSet( NameLiteralSet set, size_t *count, const LitTable **table )
 {
-    // Black magic is living in this function. Don't touch anything!!!
-    uint32_t res = 0;
-
-    if( count > poolSize )
+    switch( set )
     {
-        res = pool[0] & ~( ((uint32_t)-1) << poolSize );
-        count -= poolSize;
-        poolSize = 0;
+        case NLS_VOWELS:
+            *count = sizeof(vowelSet) / sizeof(vowelSet[0]);
+            *table = &vowelTable;
+            return vowelSet;
 
-        if( !RAND_bytes( (uint8_t*)pool, sizeof(pool) ) )
-            return false;
+        case NLS_CONSONANTS:
+            *count = sizeof(consonantSet) / sizeof(consonantSet[0]);
+            *table = &consonantTable;
+            return consonantSet;
 
-        poolSize = sizeof(pool) * 8;
+        case NLS_WORD_ENDS:
+            *count = sizeof(wordEndSet) / sizeof(wordEndSet[0]);
+            *table = &wordEndTable;
+            return wordEndSet;
+
+        default:
+            *count = 0;
+            *table = NULL;
+            return NULL;
     }
+}
 
-    while( count > 0 )
-    {
-        const int limbNo = (poolSize - 1) / 32;
-        const int limbRem = poolSize - limbNo * 32;
 
-        if( limbRem <= count )
-        {
-            res = (res << count) | pool[limbNo];
-            count -= limbRem;
-            poolSize -= limbRem;
-        }
-        else
-        {
-            res = (res << count) | (pool[limbNo] >> (limbRem - count));
-            pool[limbNo] &= ~( ((uint32_t)-1) << (limbRem - count) );
+size_t Randomizer::literalCount( NameLiteralSet set )
+{
+    size_t count;
+    const LitTable *table;
 
-            poolSize -= count;
-            count = 0;
-        }
-    }
+    literalSet( set, &count, &table );
+    return count;
+}
 
-    *dst = res;
-    return true;
+
+const char *Randomizer::literalValue( NameLiteralSet set, size_t index )
+{
+    size_t count;
+    const LitTable *table;
+    const LitInfo *literals = literalSet( set, &count, &table );
+
+    return ( index < count ) ? literals[index].value : NULL;
 }
 
 
-const LitInfo *Randomizer::getLiteral( const LitInfo *stBegin, size_t stSizeBytes )
+uint32_t Randomizer::literalWeight( NameLiteralSet set, size_t index )
 {
-    uint32_t t;
+    size_t count;
+    const LitTable *table;
+    const LitInfo *literals = literalSet( set, &count, &table );
 
-    if( !getBits( &t, 24 ) )
-        return NULL;
+    return ( index < count ) ? literals[index].weight : 0;
+}
+
+
+bool Randomizer::countLiterals( NameLiteralSet set, uint64_t *counts, size_t draws )
+{
+    Randomizer *randomizer = getInstance();
+    size_t count;
+    const LitTable *table;
+    const LitInfo *literals = literalSet( set, &count, &table );
+
+    if( NULL == literals )
+        return false;
 
-    for( const LitInfo *i = stBegin;
-         stSizeBytes >= sizeof(*i);
-         stSizeBytes -= sizeof(*i), ++i )
+    for( size_t i = 0; i < draws; ++i )
     {
-        if( i->weight > t )
-            return i;
+        const LitInfo *literal = randomizer->getLiteral( table );
+        if( NULL == literal )
+            return false;
 
-        t -= i->weight;
+        counts[literal - literals]++;
     }
 
-    return NULL;
+    return true;
+}
+
+
+OutputEntropy Randomizer::pinEntropy( int minLength, int maxLength )
+{
+    return uniformLengths( minLength, maxLength, log2( 10.0 ) );
+}
+
+
+OutputEntropy Randomizer::passwordEntropy( int minLength, int maxLength )
+{
+    return uniformLengths( minLength, maxLength, log2( (double)( sizeof(passwordCharSet) - 1 ) ) );
+}
+
+
+OutputEntropy Randomizer::passwordEntropy( const PolicyTable &policy )
+{
+    OutputEntropy res = { 0, 0, true };
+    if( !policy.isValid() )
+        return res;
+
+    // Uniform over all allowed passwords
+    res.shannonBits = res.minBits = bnLog2( policy.bounds.back() );
+    return res;
+}
+
+
+OutputEntropy Randomizer::keyEntropy( int minBytes, int maxBytes )
+{
+    return uniformLengths( minBytes, maxBytes, 8 );
+}
+
+
+OutputEntropy Randomizer::passphraseEntropy( const Wordlist &wordlist, int minWords, int maxWords )
+{
+    return uniformLengths( minWords, maxWords, wordlist.entropyBits( 1 ) );
+}
+
+
+OutputEntropy Randomizer::nameEntropy( int minSyllables, int maxSyllables )
+{
+    const double emptyConsonant = 1.0 / 4 + 3.0 / 4 * consonantSet[6].weight / ( 1 << ALIAS_WEIGHT_BITS );
+    const double dupInfo = binaryEntropy( 1.0 / 16 );
+
+    static_assert( consonantSet[6].value[0] == '\0', "Empty consonant moved" );
+
+    // The first consonant is left out in 1/4 cases, as if it were the empty one
+    double firstConsonant = -emptyConsonant * log2( emptyConsonant );
+    for( size_t c = 0; c < sizeof(consonantSet) / sizeof(consonantSet[0]); ++c )
+    {
+        const double p = 3.0 / 4 * consonantSet[c].weight / ( 1 << ALIAS_WEIGHT_BITS );
+        if( consonantSet[c].value[0] != '\0' )
+            firstConsonant -= p * log2( p );
+    }
+
+    // A single vowel cannot be duplicated
+    const double firstSyllable = firstConsonant + literalEntropy( vowelSet ) +
+                                 ( 1 - emptyConsonant ) * canDupShare( vowelSet ) * dupInfo;
+    const double nextSyllable = literalEntropy( consonantSet ) + canDupShare( consonantSet ) * dupInfo +
+                                literalEntropy( vowelSet ) + canDupShare( vowelSet ) * dupInfo;
+
+    const double firstMaxP = std::max( emptyConsonant * literalMaxP( vowelSet, false ),
+                                       3.0 / 4 * literalMaxP( consonantSet, false ) * literalMaxP( vowelSet, true ) );
+    const double nextMaxP = literalMaxP( consonantSet, true ) * literalMaxP( vowelSet, true );
+    const double endMaxP = literalMaxP( wordEndSet, false );
+
+    OutputEntropy res = { literalEntropy( wordEndSet ), 0, false };
+    double maxP = 0;
+
+    for( int count = minSyllables; count <= maxSyllables; ++count )
+    {
+        const double p = binomial( maxSyllables - minSyllables, count - minSyllables );
+
+        res.shannonBits += p * ( -log2( p ) + ( ( count > 0 ) ? firstSyllable + ( count - 1 ) * nextSyllable : 0 ) );
+        maxP = std::max( maxP, p * endMaxP * ( ( count > 0 ) ? firstMaxP * pow( nextMaxP, count - 1 ) : 1 ) );
+    }
+
+    res.minBits = -log2( maxP );
+    return res;
+}
+
+
+OutputEntropy Randomizer::nameEntropy( const NameModel &model, int minLength, int maxLength )
+{
+    // Probability mass and the most probable prefix per state, a letter at a time
+    std::vector<double> mass( model.states(), 0 ), nextMass( model.states() );
+    std::vector<double> best( model.states(), 0 ), nextBest( model.states() );
+    OutputEntropy res = { 0, 0, true };
+    double maxP = 0;
+
+    mass[model.startState()] = best[model.startState()] = 1;
+
+    for( int length = 0; length < maxLength; ++length )
+    {
+        std::fill( nextMass.begin(), nextMass.end(), 0 );
+        std::fill( nextBest.begin(), nextBest.end(), 0 );
+
+        for( uint32_t state = 0; state < model.states(); ++state )
+        {
+            if( 0 == mass[state] )
+                continue;
+
+            uint32_t weights[NAME_MODEL_SYMBOLS];
+            aliasWeights( model.columns( state ), NAME_MODEL_SYMBOLS, weights );
+
+            // A name too short draws again on the end symbol
+            const double end = (double)weights[NAME_MODEL_END] / ( 1 << ALIAS_WEIGHT_BITS );
+            const bool canEnd = length >= minLength || model.endsOnly( state );
+            const double scale = canEnd ? 1 : 1 / ( 1 - end );
+
+            if( canEnd )
+            {
+                res.shannonBits -= ( end > 0 ) ? mass[state] * end * log2( end ) : 0;
+                maxP = std::max( maxP, best[state] * end );
+            }
+
+            for( int letter = 0; letter < NAME_MODEL_LETTERS; ++letter )
+            {
+                const double p = weights[letter] * scale / ( 1 << ALIAS_WEIGHT_BITS );
+                if( 0 == p )
+                    continue;
+
+                const uint32_t next = model.nextState( state, letter );
+
+                res.shannonBits -= mass[state] * p * log2( p );
+                nextMass[next] += mass[state] * p;
+                nextBest[next] = std::max( nextBest[next], best[state] * p );
+            }
+        }
+
+        mass.swap( nextMass );
+        best.swap( nextBest );
+    }
+
+    // Names cut at maxLength
+    for( uint32_t state = 0; state < model.states(); ++state )
+        maxP = std::max( maxP, best[state] );
+
+    res.minBits = -log2( maxP );
+    return res;
+}
+
+
+double Randomizer::nameInformation( const char *name, size_t length, int minSyllables, int maxSyllables )
+{
+    double p = 0;
+
+    for( int count = minSyllables; count <= maxSyllables; ++count )
+    {
+        std::vector<double> memo( ( count + 1 ) * ( length + 1 ), -1 );
+        p += binomial( maxSyllables - minSyllables, count - minSyllables ) *
+             parseSyllables( name, length, 0, count, 0, &memo );
+    }
+
+    return ( p > 0 ) ? -log2( p ) : INFINITY;
+}
+
+
+double Randomizer::nameInformation( const NameModel &model, const char *name, size_t length, int minLength, int maxLength )
+{
+    uint32_t state = model.startState();
+    uint32_t weights[NAME_MODEL_SYMBOLS];
+    double bits = 0;
+
+    if( (int)length > maxLength )
+        return INFINITY;
+
+    for( size_t i = 0; i <= length; ++i )
+    {
+        aliasWeights( model.columns( state ), NAME_MODEL_SYMBOLS, weights );
+
+        const double end = (double)weights[NAME_MODEL_END] / ( 1 << ALIAS_WEIGHT_BITS );
+        const bool canEnd = (int)i >= minLength || model.endsOnly( state );
+
+        if( i == length )
+        {
+            // A name of maxLength letters ends without a draw
+            if( (int)length == maxLength )
+                break;
+
+            return canEnd ? bits - log2( end ) : INFINITY;
+        }
+
+        const int letter = name[i] - 'a';
+        if( letter < 0 || letter >= NAME_MODEL_LETTERS || 0 == weights[letter] )
+            return INFINITY;
+
+        bits -= log2( weights[letter] / (double)( 1 << ALIAS_WEIGHT_BITS ) / ( canEnd ? 1 : 1 - end ) );
+        state = model.nextState( state, letter );
+    }
+
+    return bits;
+}
+
+
+std::string Randomizer::makePin( int length )
+{
+    std::string res( length, '\0' );
+    res.resize( getInstance()->writePin( &res[0], length ) );
+    return res;
+}
+
+
+std::string Randomizer::makePassword( int length )
+{
+    std::string res( length, '\0' );
+    res.resize( getInstance()->writePassword( &res[0], length ) );
+    return res;
+}
+
+
+std::string Randomizer::makePassword( const PolicyTable &policy )
+{
+    std::string res( policy.maxLength(), '\0' );
+    res.resize( getInstance()->writePassword( &res[0], policy ) );
+    return res;
+}
+
+
+std::string Randomizer::makeHexBlock( int bytes )
+{
+    return makeKey( bytes, KE_HEX );
+}
+
+
+std::string Randomizer::makeKey( int bytes, KeyEncoding encoding )
+{
+    std::string res( KeyEncoder::encodedLength( encoding, bytes ), '\0' );
+    res.resize( getInstance()->writeKey( &res[0], bytes, encoding ) );
+    return res;
+}
+
+
+std::string Randomizer::makeName( int minSyllables, int maxSyllables )
+{
+    std::string res( NAME_MAX_LENGTH( maxSyllables ), '\0' );
+    res.resize( getInstance()->writeName( &res[0], minSyllables, maxSyllables ) );
+    return res;
+}
+
+
+std::string Randomizer::makeName( const NameModel &model, int minLength, int maxLength )
+{
+    std::string res( maxLength, '\0' );
+    res.resize( getInstance()->writeName( &res[0], model, minLength, maxLength ) );
+    return res;
+}
+
+
+std::string Randomizer::makePassphrase( const Wordlist &wordlist, int words, char wordSeparator )
+{
+    std::string res( PASSPHRASE_MAX_LENGTH( wordlist, words ), '\0' );
+    res.resize( getInstance()->writePassphrase( &res[0], wordlist, words, wordSeparator ) );
+    return res;
+}
+
+
+size_t Randomizer::makePins( char *dst, size_t stride, int length, size_t count )
+{
+    Randomizer *randomizer = getInstance();
+
+    for( size_t i = 0; i < count; ++i, dst += stride )
+        if( randomizer->writePin( dst, length ) != length )
+            return i;
+
+    return count;
+}
+
+
+size_t Randomizer::makePasswords( char *dst, size_t stride, int length, size_t count )
+{
+    Randomizer *randomizer = getInstance();
+    char chars[PASSWORD_BATCH_CHARS];
+    size_t i = 0;
+
+    // Short passwords are generated in blocks, so vector mapping is not cut by item bounds
+    if( length > 0 && length <= PASSWORD_BATCH_CHARS )
+    {
+        const size_t blockItems = PASSWORD_BATCH_CHARS / length;
+
+        while( i < count )
+        {
+            const size_t items = std::min( blockItems, count - i );
+            const size_t generated = randomizer->writePassword( chars, items * length ) / length;
+
+            for( size_t j = 0; j < generated; ++j )
+                copyChars( dst + ( i + j ) * stride, chars + j * length, length );
+
+            i += generated;
+            if( generated != items )
+                break;
+        }
+
+        OPENSSL_cleanse( chars, sizeof(chars) );
+        return i;
+    }
+
+    for( ; i < count; ++i, dst += stride )
+        if( randomizer->writePassword( dst, length ) != length )
+            break;
+
+    return i;
+}
+
+
+size_t Randomizer::makeNames( char *dst, size_t capacity, uint32_t *offsets, char separator,
+                              int minSyllables, int maxSyllables, size_t count )
+{
+    Randomizer *randomizer = getInstance();
+    const size_t itemCapacity = NAME_MAX_LENGTH( maxSyllables ) + 1;
+    size_t used = 0;
+    size_t i;
+
+    for( i = 0; i < count && capacity - used >= itemCapacity; ++i )
+    {
+        offsets[i] = used;
+
+        used += randomizer->writeName( dst + used, minSyllables, maxSyllables );
+        dst[used++] = separator;
+    }
+
+    offsets[i] = used;
+    return i;
+}
+
+
+size_t Randomizer::makeNames( char *dst, size_t capacity, uint32_t *offsets, char separator,
+                              const NameModel &model, int minLength, int maxLength, size_t count )
+{
+    Randomizer *randomizer = getInstance();
+    const size_t itemCapacity = maxLength + 1;
+    size_t used = 0;
+    size_t i;
+
+    for( i = 0; i < count && capacity - used >= itemCapacity; ++i )
+    {
+        offsets[i] = used;
+
+        used += randomizer->writeName( dst + used, model, minLength, maxLength );
+        dst[used++] = separator;
+    }
+
+    offsets[i] = used;
+    return i;
+}
+
+
+size_t Randomizer::makeKeys( char *dst, size_t capacity, uint32_t *offsets, char separator,
+                             int bytes, KeyEncoding encoding, size_t count )
+{
+    Randomizer *randomizer = getInstance();
+    const size_t itemCapacity = KeyEncoder::encodedLength( encoding, bytes ) + 1;
+    uint8_t raw[RANDOM_BUFFER_SIZE];
+    size_t used = 0;
+    size_t i = 0;
+
+    // Raw bytes of many short keys are taken at once
+    const size_t blockItems = ( bytes > 0 && bytes <= RANDOM_BUFFER_SIZE ) ? RANDOM_BUFFER_SIZE / bytes : 1;
+
+    while( i < count && capacity - used >= itemCapacity )
+    {
+        const size_t items = std::min( std::min( blockItems, count - i ), ( capacity - used ) / itemCapacity );
+
+        if( bytes > RANDOM_BUFFER_SIZE )
+        {
+            const size_t length = randomizer->writeKey( dst + used, bytes, encoding );
+            if( 0 == length )
+                break;
+
+            offsets[i++] = used;
+            used += length;
+            dst[used++] = separator;
+            continue;
+        }
+
+        if( !randomizer->getBytes( raw, items * bytes ) )
+            break;
+
+        randomizer->drawnBits += items * bytes * 8;
+
+        for( size_t j = 0; j < items; ++j, ++i )
+        {
+            offsets[i] = used;
+            used += KeyEncoder::encode( encoding, dst + used, raw + j * bytes, bytes );
+            dst[used++] = separator;
+        }
+    }
+
+    offsets[i] = used;
+    OPENSSL_cleanse( raw, sizeof(raw) );
+
+    return i;
+}
+
+
+size_t Randomizer::makePassphrases( char *dst, size_t capacity, uint32_t *offsets, char separator,
+                                    const Wordlist &wordlist, int words, char wordSeparator, size_t count )
+{
+    Randomizer *randomizer = getInstance();
+    const size_t itemCapacity = PASSPHRASE_MAX_LENGTH( wordlist, words ) + 1;
+    size_t used = 0;
+    size_t i;
+
+    for( i = 0; i < count && capacity - used >= itemCapacity; ++i )
+    {
+        offsets[i] = used;
+
+        const size_t length = randomizer->writePassphrase( dst + used, wordlist, words, wordSeparator );
+        if( 0 == length && words > 0 )
+            break;
+
+        used += length;
+        dst[used++] = separator;
+    }
+
+    offsets[i] = used;
+    return i;
+}
+
+
+int Randomizer::writePin( char *dst, int length )
+{
+    int written = 0;
+    uint32_t t;
+
+    // 3 digits from 10 bits are accepted in 1000 of 1024 cases
+    for( ; length - written >= 3; written += 3 )
+    {
+        if( !getUniform( &t, 1000 ) )
+            return written;
+
+        dst[written] = '0' + t % 10;
+        dst[written + 1] = '0' + t / 10 % 10;
+        dst[written + 2] = '0' + t / 100;
+    }
+
+    if( length > written )
+    {
+        if( !getUniform( &t, ( length - written == 2 ) ? 100 : 10 ) )
+            return written;
+
+        for( ; written < length; ++written, t /= 10 )
+            dst[written] = '0' + t % 10;
+    }
+
+    return written;
+}
+
+
+int Randomizer::writePassword( char *dst, int length )
+{
+    uint32_t t;
+    int i = 0;
+
+#ifdef PASSWORD_MAP_BULK
+    while( length - i >= 4 )
+    {
+        /*
+         * Whole groups of 4 chars are mapped straight from the buffer once
+         * the bit stream head is byte aligned there, see unreadReservoir().
+         */
+        if( unreadReservoir() && RANDOM_BUFFER_SIZE - bufferUsed >= 3 )
+        {
+            const size_t groups = std::min( (size_t)( length - i ) / 4, ( RANDOM_BUFFER_SIZE - bufferUsed ) / 3 );
+
+            mapPasswordGroups( dst + i, buffer + bufferUsed, groups );
+            memset( buffer + bufferUsed, 0, groups * 3 );
+            drawnBits += groups * 24;
+
+            bufferUsed += groups * 3;
+            i += groups * 4;
+            continue;
+        }
+
+        if( !getBits( &t, 6 ) )
+            return i;
+
+        dst[i++] = passwordCharSet[t];
+    }
+#endif
+
+    for( ; i < length; ++i )
+    {
+        if( !getBits( &t, 6 ) )
+            return i;
+
+        dst[i] = passwordCharSet[t];
+    }
+
+    return length;
+}
+
+
+int Randomizer::writePassword( char *dst, const PolicyTable &policy )
+{
+    if( !policy.isValid() )
+        return 0;
+
+    uint32_t t;
+
+    // Composition is the first one whose running total exceeds a draw below the grand total
+    BIGNUM *draw = BN_new();
+    if( NULL == draw || !getUniform( draw, policy.bounds.back() ) )
+    {
+        BN_clear_free( draw );
+        return 0;
+    }
+
+    size_t low = 0, high = policy.bounds.size() - 1;
+    while( low < high )
+    {
+        const size_t middle = ( low + high ) / 2;
+
+        if( BN_cmp( policy.bounds[middle], draw ) > 0 )
+            high = middle;
+        else
+            low = middle + 1;
+    }
+
+    BN_clear_free( draw );
+
+    size_t lengthIndex = 0;
+    while( low >= policy.lengths[lengthIndex].first + policy.lengths[lengthIndex].count )
+        lengthIndex++;
+
+    const int length = policy.lengths[lengthIndex].length;
+
+    // Class slots in a row, then shuffled: each order of a multiset is equally likely
+    uint8_t slots[POLICY_MAX_LENGTH];
+    const uint8_t *counts = &policy.compositions[low * CC_COUNT];
+    int filled = 0;
+
+    for( int i = 0; i < CC_COUNT; ++i )
+        for( int j = 0; j < counts[i]; ++j )
+            slots[filled++] = i;
+
+    bool ok = true;
+    int written = 0;
+
+    for( int i = length - 1; ok && i > 0; --i )
+    {
+        ok = getUniform( &t, i + 1 );
+        std::swap( slots[i], slots[ok ? t : i] );
+    }
+
+    for( ; ok && written < length; ++written )
+    {
+        const std::string &alphabet = policy.alphabets[slots[written]];
+
+        ok = getUniform( &t, alphabet.size() );
+        dst[written] = ok ? alphabet[t] : '\0';
+    }
+
+    OPENSSL_cleanse( slots, sizeof(slots) );
+    return ok ? written : 0;
+}
+
+
+size_t Randomizer::writeKey( char *dst, int bytes, KeyEncoding encoding )
+{
+    uint8_t stackRaw[KEY_STACK_BYTES];
+    std::vector<uint8_t> heapRaw;
+    uint8_t *raw = stackRaw;
+    size_t length = 0;
+
+    if( bytes > KEY_STACK_BYTES )
+    {
+        heapRaw.resize( bytes );
+        raw = &heapRaw[0];
+    }
+
+    if( getBytes( raw, bytes ) )
+    {
+        length = KeyEncoder::encode( encoding, dst, raw, bytes );
+        drawnBits += bytes * 8;
+    }
+
+    OPENSSL_cleanse( raw, bytes );
+    return length;
+}
+
+
+int Randomizer::writeName( char *dst, int minSyllables, int maxSyllables )
+{
+    const LitInfo *literal;
+    char *res = dst;
+    uint32_t t;
+
+    // Randomize actual syllable count with norm distribution
+    int syllableCount = minSyllables;
+    for( int i = 0; i < maxSyllables - minSyllables; ++i )
+    {
+        if( !getBits( &t, 1 ) )
+            return res - dst;
+
+        syllableCount += t;
+    }
+
+    // Generate syllables
+    for( int i = 0; i < syllableCount; ++i )
+    {
+        literal = getLiteral( &consonantTable );
+        if( NULL == literal || !getBits( &t, 4 ) )
+            return res - dst;
+
+        if( 0 != i || t >= 4 )
+            res = appendLiteral( res, literal );
+
+        if( t == 0 && literal->canDup && 0 != i )
+        {
+            // Consonant duplication
+            res = appendLiteral( res, literal );
+        }
+        else if( t >= 12 )
+        {
+            // Additional consonant
+            literal = getLiteral( &consonantTable );
+            if( NULL == literal || !getBits( &t, 4 ) )
+                return res - dst;
+        }
+
+        literal = getLiteral( &vowelTable );
+        if( NULL == literal || !getBits( &t, 4 ) )
+            return res - dst;
+
+        res = appendLiteral( res, literal );
+        if( t == 0 && literal->canDup && res - dst > 1 )
+        {
+            // Vowel duplication
+            res = appendLiteral( res, literal );
+        }
+    }
+
+    // Add some word end
+    literal = getLiteral( &wordEndTable );
+    if( NULL != literal )
+        res = appendLiteral( res, literal );
+
+    return res - dst;
+}
+
+
+int Randomizer::writeName( char *dst, const NameModel &model, int minLength, int maxLength )
+{
+    uint32_t state = model.startState();
+    int length = 0;
+    uint32_t t;
+
+    while( length < maxLength )
+    {
+        if( !getBits( &t, ALIAS_WEIGHT_BITS ) )
+            break;
+
+        const int symbol = aliasPick( model.columns( state ), NAME_MODEL_SHIFT, t );
+
+        if( NAME_MODEL_END == symbol )
+        {
+            // Too short: draw again, which samples the letters in their own proportions
+            if( length >= minLength || model.endsOnly( state ) )
+                break;
+
+            continue;
+        }
+
+        dst[length++] = 'a' + symbol;
+        state = model.nextState( state, symbol );
+    }
+
+    return length;
+}
+
+
+size_t Randomizer::writePassphrase( char *dst, const Wordlist &wordlist, int words, char wordSeparator )
+{
+    // getUniform() picks the draw width: a word of the 7776 in the EFF list takes 13.7 bits for 12.9 of entropy
+    char *res = dst;
+    uint32_t t;
+
+    for( int i = 0; i < words; ++i )
+    {
+        if( !getUniform( &t, wordlist.size() ) )
+            return 0;
+
+        if( 0 != i )
+            *res++ = wordSeparator;
+
+        size_t length;
+        const char *word = wordlist.word( t, &length );
+
+        memcpy( res, word, length );
+        res += length;
+    }
+
+    return res - dst;
+}
+
+
+bool Randomizer::getUniform( uint32_t *dst, uint32_t modulo )
+{
+    /*
+     * D. Lemire's multiply-shift with rejection on a word of <bits> bits:
+     * x * modulo / 2**bits is uniform when the low part of the product is not
+     * below 2**bits % modulo. The narrowest word may be rejected often (16384
+     * is 1.64 * 10000), so the width with the lowest expected bit cost is
+     * chosen and cached with its threshold for the last two moduli.
+     */
+    if( modulo <= 1 )
+    {
+        *dst = 0;
+        return ( 1 == modulo );
+    }
+
+    UniformRange *range = &uniformRanges[0];
+    if( range->modulo != modulo )
+    {
+        // PINs alternate a group and a tail modulo, keep both
+        std::swap( uniformRanges[0], uniformRanges[1] );
+
+        if( range->modulo != modulo )
+        {
+            const int minBits = 32 - __builtin_clz( modulo - 1 );
+            double bestCost = 0.0;
+
+            for( int bits = minBits; bits <= std::min( minBits + UNIFORM_EXTRA_BITS, 32 ); ++bits )
+            {
+                const uint64_t words = (uint64_t)1 << bits;
+                const uint64_t threshold = words % modulo;
+                const double cost = (double)bits * words / ( words - threshold );
+
+                if( bits == minBits || cost < bestCost )
+                {
+                    bestCost = cost;
+                    range->bits = bits;
+                    range->threshold = threshold;
+                }
+            }
+
+            range->modulo = modulo;
+        }
+    }
+
+    const int bits = range->bits;
+    const uint64_t mask = ( (uint64_t)1 << bits ) - 1;
+    uint64_t product;
+    uint32_t x;
+
+    do
+    {
+        if( !getBits( &x, bits ) )
+            return false;
+
+        product = (uint64_t)x * modulo;
+    }
+    while( ( product & mask ) < range->threshold );
+
+    *dst = (uint32_t)( product >> bits );
+    return true;
+}
+
+
+bool Randomizer::getUniform( BIGNUM *dst, const BIGNUM *modulo )
+{
+    // Plain rejection on as many bits as the modulo has, accepted in over half of the cases
+    const int bits = BN_num_bits( modulo );
+    const int bytes = ( bits + 7 ) / 8;
+    uint8_t raw[BIG_UNIFORM_BYTES];
+    uint32_t t;
+
+    if( BN_is_zero( modulo ) || bytes > BIG_UNIFORM_BYTES )
+        return false;
+
+    do
+    {
+        for( int i = 0; i < bytes; ++i )
+        {
+            // Big-endian, the leading byte holds the odd bits
+            if( !getBits( &t, ( 0 == i && bits % 8 != 0 ) ? bits % 8 : 8 ) )
+            {
+                OPENSSL_cleanse( raw, sizeof(raw) );
+                return false;
+            }
+
+            raw[i] = (uint8_t)t;
+        }
+
+        if( NULL == BN_bin2bn( raw, bytes, dst ) )
+        {
+            OPENSSL_cleanse( raw, sizeof(raw) );
+            return false;
+        }
+    }
+    while( BN_cmp( dst, modulo ) >= 0 );
+
+    OPENSSL_cleanse( raw, sizeof(raw) );
+    return true;
+}
+
+
+bool Randomizer::getBits( uint32_t *dst, int count )
+{
+    /*
+     * Bits are taken from the reservoir LSB first and shifted out, so every
+     * random bit is returned exactly once. Requests of up to 32 bits need
+     * at most one 64-bit refill, split between this result and the reservoir.
+     */
+    const unsigned generation = EntropySource::forkGeneration();
+    if( generation != bufferGeneration )
+    {
+        // Reservoir and buffer are shared with the parent after fork(), drop both
+        reservoir = 0;
+        reservoirBits = 0;
+        bufferUsed = RANDOM_BUFFER_SIZE;
+        bufferGeneration = generation;
+    }
+
+    drawnBits += count;
+
+    if( count <= reservoirBits )
+    {
+        *dst = (uint32_t)( reservoir & ( ( (uint64_t)1 << count ) - 1 ) );
+        reservoir >>= count;
+        reservoirBits -= count;
+
+        return true;
+    }
+
+    uint64_t fresh;
+    if( bufferUsed + sizeof(fresh) <= RANDOM_BUFFER_SIZE )
+    {
+        // Common case: whole word is in the buffer
+        memcpy( &fresh, buffer + bufferUsed, sizeof(fresh) );
+        memset( buffer + bufferUsed, 0, sizeof(fresh) );
+        bufferUsed += sizeof(fresh);
+    }
+    else if( !getBytes( (uint8_t*)&fresh, sizeof(fresh) ) )
+    {
+        return false;
+    }
+
+    const int missing = count - reservoirBits;
+    const uint64_t res = reservoir | ( fresh << reservoirBits );
+
+    *dst = (uint32_t)( res & ( ( (uint64_t)1 << count ) - 1 ) );
+    reservoir = fresh >> missing;
+    reservoirBits = 64 - missing;
+
+    return true;
+}
+
+
+bool Randomizer::unreadReservoir()
+{
+    /*
+     * Reservoir holds the tail of the last word taken from the buffer. If it
+     * is a whole number of bytes still present in the buffer, put it back:
+     * then the next random bit is the lowest bit of buffer[bufferUsed].
+     */
+    if( bufferGeneration != EntropySource::forkGeneration() )
+        return false;
+
+    const size_t bytes = reservoirBits / 8;
+    if( reservoirBits % 8 != 0 || bytes > bufferUsed )
+        return false;
+
+    bufferUsed -= bytes;
+    for( size_t i = 0; i < bytes; ++i )
+        buffer[bufferUsed + i] = (uint8_t)( reservoir >> ( 8 * i ) );
+
+    reservoir = 0;
+    reservoirBits = 0;
+
+    return true;
+}
+
+
+bool Randomizer::getBytes( uint8_t *dst, size_t count )
+{
+    // Buffered bytes are shared with the parent after fork(), never reuse them
+    const unsigned generation = EntropySource::forkGeneration();
+    if( generation != bufferGeneration )
+    {
+        bufferUsed = RANDOM_BUFFER_SIZE;
+        bufferGeneration = generation;
+    }
+
+    while( count > 0 )
+    {
+        if( RANDOM_BUFFER_SIZE == bufferUsed )
+        {
+            if( !source->fill( buffer, RANDOM_BUFFER_SIZE ) )
+                return false;
+
+            bufferUsed = 0;
+        }
+
+        size_t chunk = RANDOM_BUFFER_SIZE - bufferUsed;
+        if( chunk > count )
+            chunk = count;
+
+        memcpy( dst, buffer + bufferUsed, chunk );
+        memset( buffer + bufferUsed, 0, chunk );
+
+        dst += chunk;
+        count -= chunk;
+        bufferUsed += chunk;
+    }
+
+    return true;
+}
+
+
+const LitInfo *Randomizer::getLiteral( const LitTable *table )
+{
+    uint32_t t;
+
+    if( !getBits( &t, ALIAS_WEIGHT_BITS ) )
+        return NULL;
+
+    return &table->literals[aliasPick( table->columns, table->shift, t )];
 }
 
 
 Randomizer *Randomizer::getInstance()
 {
-    static Randomizer *singleton = new Randomizer();
-    return singleton;
+    // Each thread has its own generator state and entropy source, so no locking is needed
+    static thread_local Randomizer instance;
+    return &instance;
 }
@@ -0,0 +1,202 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "RawStream.h"
+#include "Randomizer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <openssl/crypto.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+
+static bool fillSlice( uint8_t *dst, size_t size, uint64_t offset )
+{
+    if( !Randomizer::isSeeded() )
+        return Randomizer::makeBytes( dst, size );
+
+    // Seeded output depends on the offset only, not on block size and thread count
+    for( size_t done = 0; done < size; done += RAW_SEEDED_STREAM_BYTES )
+    {
+        if( !Randomizer::selectStream( ( offset + done ) / RAW_SEEDED_STREAM_BYTES + 1 ) ||
+            !Randomizer::makeBytes( dst + done, std::min( (size_t)RAW_SEEDED_STREAM_BYTES, size - done ) ) )
+            return false;
+    }
+
+    return true;
+}
+
+
+static bool fillBlock( uint8_t *block, size_t size, uint64_t offset, int threadCount )
+{
+    const long pageSize = sysconf( _SC_PAGESIZE );
+    const size_t slice = ( size / threadCount + pageSize - 1 ) / pageSize * pageSize;
+
+    if( threadCount < 2 || slice >= size )
+        return fillSlice( block, size, offset );
+
+    std::vector<std::thread> workers;
+    std::vector<char> results( threadCount, 1 );
+
+    // Slice 0 is filled by the calling thread
+    for( int i = 1; i < threadCount && i * slice < size; ++i )
+    {
+        workers.push_back( std::thread( [=, &results]()
+        {
+            results[i] = fillSlice( block + i * slice, std::min( slice, size - i * slice ), offset + i * slice );
+        } ) );
+    }
+
+    results[0] = fillSlice( block, slice, offset );
+
+    for( size_t i = 0; i < workers.size(); ++i )
+        workers[i].join();
+
+    return std::find( results.begin(), results.end(), 0 ) == results.end();
+}
+
+
+// Returns false with errno = EINVAL if fd does not take vmsplice() at all
+static bool spliceBlock( int fd, const uint8_t *data, size_t size )
+{
+    struct iovec chunk = { (void *)data, size };
+
+    while( chunk.iov_len > 0 )
+    {
+        const ssize_t written = vmsplice( fd, &chunk, 1, 0 );
+        if( written < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+
+            return false;
+        }
+
+        chunk.iov_base = (uint8_t *)chunk.iov_base + written;
+        chunk.iov_len -= written;
+    }
+
+    return true;
+}
+
+
+bool RawStream::write( int fd, uint64_t bytes, int threadCount )
+{
+    struct stat info;
+    bool toPipe = ( fstat( fd, &info ) == 0 ) && S_ISFIFO( info.st_mode );
+    size_t blockSize = RAW_BLOCK_SIZE;
+
+    if( toPipe )
+    {
+        // Pipe size is the page count it holds, so a block fills the pipe exactly
+        int pipeSize = fcntl( fd, F_SETPIPE_SZ, RAW_BLOCK_SIZE );
+        if( pipeSize < 0 )
+            pipeSize = fcntl( fd, F_GETPIPE_SZ );
+
+        if( pipeSize > 0 )
+            blockSize = pipeSize;
+        else
+            toPipe = false;
+    }
+
+    /*
+     * A spliced block stays referenced by the pipe until it is read. Once
+     * a whole block is in the pipe, the previous one has surely left it,
+     * so two blocks taking turns are never changed while still queued.
+     */
+    const int blockCount = toPipe ? 2 : 1;
+    uint8_t *blocks = (uint8_t *)mmap( NULL, blockCount * blockSize, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( MAP_FAILED == blocks )
+        return false;
+
+    bool ok = true;
+    int current = 0;
+    uint64_t offset = 0;
+    size_t size = 0;
+
+    while( ok && offset < bytes )
+    {
+        uint8_t *block = blocks + current * blockSize;
+        size = (size_t)std::min( (uint64_t)blockSize, bytes - offset );
+
+        ok = fillBlock( block, size, offset, std::max( 1, threadCount ) );
+
+        if( ok && toPipe && !spliceBlock( fd, block, size ) )
+        {
+            // No vmsplice() on this kernel or file, nothing was queued yet
+            toPipe = ( EINVAL != errno && ENOSYS != errno );
+            ok = !toPipe && writeAll( fd, block, size );
+        }
+        else if( ok && !toPipe )
+        {
+            ok = writeAll( fd, block, size );
+        }
+
+        offset += size;
+        current = ( current + 1 ) % blockCount;
+    }
+
+    /*
+     * The last spliced block may still be queued. The other one has left
+     * the pipe only if the last block filled it, otherwise both are left
+     * to the pipe, which releases the pages once they are read.
+     */
+    if( !toPipe )
+        OPENSSL_cleanse( blocks, blockCount * blockSize );
+    else if( blockSize == size )
+        OPENSSL_cleanse( blocks + current * blockSize, blockSize );
+
+    munmap( blocks, blockCount * blockSize );
+    return ok;
+}
+
+
+bool RawStream::writeAll( int fd, const void *data, size_t size )
+{
+    const char *next = (const char *)data;
+
+    while( size > 0 )
+    {
+        const ssize_t written = ::write( fd, next, size );
+        if( written < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+
+            return false;
+        }
+
+        next += written;
+        size -= written;
+    }
+
+    return true;
+}
@@ -0,0 +1,500 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "SecretServer.h"
+#include "Randomizer.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <thread>
+
+
+// Room for a status line: "OK <count>" or an error
+#define REPLY_LINE_MAX 64
+
+
+static void wipe( std::string *data )
+{
+    std::fill( data->begin(), data->end(), 0 );
+    data->clear();
+}
+
+
+// A client going away must not kill the server with SIGPIPE
+static bool sendAll( int fd, const char *data, size_t size )
+{
+    while( size > 0 )
+    {
+        const ssize_t sent = send( fd, data, size, MSG_NOSIGNAL );
+        if( sent < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+
+            return false;
+        }
+
+        data += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+
+SecretServer::SecretServer( const GenerationJob &defaultJob, const PasswordPolicy *policy )
+: defaults( defaultJob )
+, havePolicy( NULL != policy )
+, refillPending( false )
+, stopping( false )
+{
+    if( havePolicy )
+        rules = *policy;
+}
+
+
+SecretServer::~SecretServer()
+{
+    for( size_t i = 0; i < pools.size(); i++ )
+    {
+        wipe( &pools[i]->items );
+        delete pools[i]->policy;
+        delete pools[i];
+    }
+}
+
+
+bool SecretServer::serve( const char *path )
+{
+    // Every connection thread would repeat the same seeded stream
+    if( Randomizer::isSeeded() )
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    struct sockaddr_un address;
+    memset( &address, 0, sizeof(address) );
+    address.sun_family = AF_UNIX;
+
+    if( strlen( path ) >= sizeof(address.sun_path) )
+    {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    strcpy( address.sun_path, path );
+
+    // A socket left by a killed server, never a regular file
+    struct stat status;
+    if( lstat( path, &status ) == 0 && S_ISSOCK( status.st_mode ) )
+        unlink( path );
+
+    const int listenFd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if( listenFd < 0 )
+        return false;
+
+    // Secrets are for the owner only
+    const mode_t previousMask = umask( 077 );
+    const bool bound = bind( listenFd, (struct sockaddr*)&address, sizeof(address) ) == 0;
+    umask( previousMask );
+
+    if( !bound || listen( listenFd, SOMAXCONN ) != 0 )
+    {
+        const int error = errno;
+        if( bound )
+            unlink( path );
+        close( listenFd );
+        errno = error;
+        return false;
+    }
+
+    // Threads inherit the blocked signals, only the poll below sees them
+    sigset_t signals, previousSignals;
+    sigemptyset( &signals );
+    sigaddset( &signals, SIGINT );
+    sigaddset( &signals, SIGTERM );
+    pthread_sigmask( SIG_BLOCK, &signals, &previousSignals );
+
+    const int signalFd = signalfd( -1, &signals, SFD_CLOEXEC );
+    bool ok = signalFd >= 0;
+    int error = errno;
+
+    std::thread refill;
+    if( ok )
+        refill = std::thread( &SecretServer::refillLoop, this );
+
+    while( ok )
+    {
+        struct pollfd events[2] = { { listenFd, POLLIN, 0 }, { signalFd, POLLIN, 0 } };
+
+        if( poll( events, 2, -1 ) < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+
+            error = errno;
+            ok = false;
+            break;
+        }
+
+        if( events[1].revents & POLLIN )
+            break;
+
+        const int fd = accept4( listenFd, NULL, NULL, SOCK_CLOEXEC );
+        if( fd < 0 )
+        {
+            // Out of descriptors or a client gone before accept(), the server goes on
+            if( EINTR == errno || ECONNABORTED == errno || EMFILE == errno || ENFILE == errno )
+                continue;
+
+            error = errno;
+            ok = false;
+            break;
+        }
+
+        std::lock_guard<std::mutex> guard( lock );
+        connections.insert( fd );
+        std::thread( &SecretServer::connectionLoop, this, fd ).detach();
+    }
+
+    {
+        std::unique_lock<std::mutex> guard( lock );
+        stopping = true;
+        refillWanted.notify_all();
+
+        // Blocked reads return, every connection thread closes its socket
+        for( std::set<int>::const_iterator i = connections.begin(); i != connections.end(); ++i )
+            shutdown( *i, SHUT_RDWR );
+
+        while( !connections.empty() )
+            connectionClosed.wait( guard );
+    }
+
+    if( refill.joinable() )
+        refill.join();
+
+    if( signalFd >= 0 )
+        close( signalFd );
+
+    close( listenFd );
+    unlink( path );
+    pthread_sigmask( SIG_SETMASK, &previousSignals, NULL );
+
+    errno = error;
+    return ok;
+}
+
+
+void SecretServer::connectionLoop( int fd )
+{
+    std::string input, reply;
+    char buffer[1 << 16];
+    bool open = true;
+
+    while( open )
+    {
+        const ssize_t received = recv( fd, buffer, sizeof(buffer), 0 );
+        if( received < 0 && EINTR == errno )
+            continue;
+
+        if( received <= 0 )
+            break;
+
+        input.append( buffer, received );
+
+        // Every complete request of this read, answered in order
+        size_t start = 0, end;
+        while( open && ( end = input.find( '\n', start ) ) != std::string::npos )
+        {
+            answer( input.substr( start, end - start ), &reply );
+            start = end + 1;
+
+            if( reply.size() >= SERVE_REPLY_FLUSH )
+            {
+                open = sendAll( fd, reply.data(), reply.size() );
+                wipe( &reply );
+            }
+        }
+
+        input.erase( 0, start );
+
+        if( input.size() > SERVE_LINE_MAX )
+        {
+            BulkGenerator::reserveSecret( &reply, reply.size() + REPLY_LINE_MAX );
+            reply.append( "ERR line too long\n" );
+            open = false;
+        }
+
+        if( !reply.empty() )
+        {
+            if( !sendAll( fd, reply.data(), reply.size() ) )
+                open = false;
+
+            wipe( &reply );
+        }
+    }
+
+    std::lock_guard<std::mutex> guard( lock );
+    connections.erase( fd );
+    close( fd );
+    connectionClosed.notify_all();
+}
+
+
+void SecretServer::refillLoop()
+{
+    std::unique_lock<std::mutex> guard( lock );
+
+    while( !stopping )
+    {
+        if( !refillPending )
+        {
+            refillWanted.wait( guard );
+            continue;
+        }
+
+        refillPending = false;
+
+        // Pools may be added while unlocked, they are never removed
+        for( size_t i = 0; i < pools.size() && !stopping; i++ )
+        {
+            Pool *pool = pools[i];
+            if( pool->ready >= SERVE_POOL_ITEMS / 2 )
+                continue;
+
+            const long long wanted = SERVE_POOL_ITEMS - pool->ready;
+            std::string batch;
+
+            guard.unlock();
+            const bool ok = generate( pool, wanted, &batch );
+            guard.lock();
+
+            if( ok )
+            {
+                // A fresh buffer, the old one is wiped as a whole
+                std::string items;
+                items.reserve( pool->items.size() - pool->head + batch.size() );
+                items.append( pool->items, pool->head, std::string::npos );
+                items.append( batch );
+
+                wipe( &pool->items );
+                pool->items.swap( items );
+                pool->head = 0;
+                pool->ready += wanted;
+            }
+
+            wipe( &batch );
+        }
+    }
+}
+
+
+void SecretServer::answer( const std::string &line, std::string *reply )
+{
+    long long count;
+    char entityName[32], lengthText[32], extra;
+
+    // The reply may hold secrets of earlier requests, it must not reallocate unwiped
+    BulkGenerator::reserveSecret( reply, reply->size() + REPLY_LINE_MAX );
+
+    const int fields = sscanf( line.c_str(), "%lld %31s %31s %c", &count, entityName, lengthText, &extra );
+    if( fields < 2 || fields > 3 || count < 0 || count > SERVE_MAX_COUNT )
+    {
+        reply->append( "ERR bad request\n" );
+        return;
+    }
+
+    const RandomEntity entity = BulkGenerator::parseEntity( entityName );
+    int minLength, maxLength;
+
+    if( !BulkGenerator::defaultLengths( entity, NULL != defaults.nameModel, &minLength, &maxLength ) )
+    {
+        reply->append( "ERR unknown entity\n" );
+        return;
+    }
+
+    // Lengths of a policy preset, unless the request has its own
+    if( RE_PASSWD == entity && havePolicy && 0 != rules.minLength )
+    {
+        minLength = rules.minLength;
+        maxLength = rules.maxLength;
+    }
+
+    if( 3 == fields )
+    {
+        const int lengths = sscanf( lengthText, "%d-%d%c", &minLength, &maxLength, &extra );
+        if( 1 == lengths )
+            maxLength = minLength;
+        else if( 2 != lengths )
+            minLength = 0;
+    }
+
+    if( minLength < 1 || minLength > maxLength || maxLength > SERVE_MAX_LENGTH )
+    {
+        reply->append( "ERR bad length\n" );
+        return;
+    }
+
+    if( RE_PHRASE == entity && NULL == defaults.wordlist )
+    {
+        reply->append( "ERR no word list\n" );
+        return;
+    }
+
+    const char *error;
+    Pool *pool = findPool( entity, minLength, maxLength, &error );
+    if( NULL == pool )
+    {
+        reply->append( "ERR " ).append( error ).append( "\n" );
+        return;
+    }
+
+    BulkGenerator::reserveSecret( reply, reply->size() + REPLY_LINE_MAX +
+                                         count * BulkGenerator::itemCapacity( poolJob( pool, count ) ) );
+
+    const size_t start = reply->size();
+    reply->append( "OK " ).append( std::to_string( count ) ).append( "\n" );
+
+    if( !take( pool, count, reply ) )
+    {
+        std::fill( reply->begin() + start, reply->end(), 0 );
+        reply->resize( start );
+        reply->append( "ERR generation failed\n" );
+    }
+}
+
+
+SecretServer::Pool *SecretServer::findPool( RandomEntity entity, int minLength, int maxLength, const char **error )
+{
+    std::lock_guard<std::mutex> guard( lock );
+
+    for( size_t i = 0; i < pools.size(); i++ )
+    {
+        if( pools[i]->entity == entity && pools[i]->minLength == minLength && pools[i]->maxLength == maxLength )
+            return pools[i];
+    }
+
+    if( pools.size() >= SERVE_MAX_POOLS )
+    {
+        *error = "too many kinds of requests";
+        return NULL;
+    }
+
+    PolicyTable *table = NULL;
+    if( RE_PASSWD == entity && havePolicy )
+    {
+        if( maxLength > POLICY_MAX_LENGTH )
+        {
+            *error = "length over the policy limit";
+            return NULL;
+        }
+
+        PasswordPolicy policy = rules;
+        policy.minLength = minLength;
+        policy.maxLength = maxLength;
+
+        table = new PolicyTable( policy );
+        if( !table->isValid() )
+        {
+            delete table;
+            *error = "policy cannot be satisfied";
+            return NULL;
+        }
+    }
+
+    Pool *pool = new Pool;
+    pool->entity = entity;
+    pool->minLength = minLength;
+    pool->maxLength = maxLength;
+    pool->policy = table;
+    pool->head = 0;
+    pool->ready = 0;
+    pools.push_back( pool );
+
+    refillPending = true;
+    refillWanted.notify_one();
+    return pool;
+}
+
+
+bool SecretServer::take( Pool *pool, long long count, std::string *reply )
+{
+    long long taken = 0;
+
+    {
+        std::lock_guard<std::mutex> guard( lock );
+
+        const size_t begin = pool->head;
+        size_t end = begin;
+
+        for( ; taken < count && pool->ready > 0; taken++, pool->ready-- )
+            end = pool->items.find( '\n', end ) + 1;
+
+        // Served items never stay in the pool
+        reply->append( pool->items, begin, end - begin );
+        std::fill( pool->items.begin() + begin, pool->items.begin() + end, 0 );
+        pool->head = end;
+
+        if( pool->ready < SERVE_POOL_ITEMS / 2 && !refillPending )
+        {
+            refillPending = true;
+            refillWanted.notify_one();
+        }
+    }
+
+    return taken == count || generate( pool, count - taken, reply );
+}
+
+
+bool SecretServer::generate( const Pool *pool, long long count, std::string *dst ) const
+{
+    BulkGenerator generator( poolJob( pool, count ) );
+    return generator.append( dst );
+}
+
+
+GenerationJob SecretServer::poolJob( const Pool *pool, long long count ) const
+{
+    GenerationJob job = defaults;
+    job.entity = pool->entity;
+    job.count = count;
+    job.minLength = pool->minLength;
+    job.maxLength = pool->maxLength;
+    job.policy = pool->policy;
+    job.unique = NULL;
+    job.permutation = NULL;
+    job.measure = false;
+
+    return job;
+}
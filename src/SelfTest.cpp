@@ -0,0 +1,403 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "SelfTest.h"
+#include "Randomizer.h"
+#include "PasswordPolicy.h"
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#define SELFTEST_PASSWORD_LENGTH  16
+#define SELFTEST_PIN_LENGTH       6
+#define SELFTEST_HEX_BYTES        16
+#define SELFTEST_NAME_SYLLABLES   2, 5
+
+
+enum SelfTestEntity { STE_PASSWORD, STE_PIN, STE_HEX };
+
+
+// Probability of a result at least this far from the expected one, on either side
+static double chiSquareP( double chiSquare, int df )
+{
+    if( df < 1 )
+        return 1;
+
+    if( isinf( chiSquare ) )
+        return 0;
+
+    // Wilson-Hilferty: the cube root of chi-square / df is close to normal
+    const double v = 2.0 / ( 9 * df );
+    const double z = ( cbrt( chiSquare / df ) - ( 1 - v ) ) / sqrt( v );
+
+    return erfc( fabs( z ) / sqrt( 2.0 ) );
+}
+
+
+// Per-position counts and serial correlation sums of a symbol stream
+struct SelfTest::Symbols
+{
+    std::vector<uint64_t> counts;  // position * alphabet size + symbol
+    uint64_t n;
+    uint64_t sum;
+    uint64_t sumSquares;
+    uint64_t sumProducts;          // Of every symbol and the next one
+    int last;                      // -1 before the first symbol
+
+    Symbols()
+    : n( 0 ), sum( 0 ), sumSquares( 0 ), sumProducts( 0 ), last( -1 )
+    {
+    }
+
+    void add( const char *item, int length, int alphabetSize, const int8_t *map )
+    {
+        for( int i = 0; i < length; ++i )
+        {
+            int symbol = map[(uint8_t)item[i]];
+
+            // Foreign chars land in a cell of their own, which expects nothing
+            if( symbol < 0 )
+                symbol = alphabetSize;
+
+            counts[i * ( alphabetSize + 1 ) + symbol]++;
+
+            n++;
+            sum += symbol;
+            sumSquares += symbol * symbol;
+            if( last >= 0 )
+                sumProducts += last * symbol;
+
+            last = symbol;
+        }
+    }
+
+    void merge( const Symbols &other )
+    {
+        for( size_t i = 0; i < counts.size(); ++i )
+            counts[i] += other.counts[i];
+
+        n += other.n;
+        sum += other.sum;
+        sumSquares += other.sumSquares;
+        sumProducts += other.sumProducts;
+    }
+};
+
+
+SelfTest::SelfTest( long long sampleCount, int threadCount )
+: samples( sampleCount )
+, threads( std::max( 1, threadCount ) )
+, failed( false )
+{
+}
+
+
+bool SelfTest::run( FILE *out )
+{
+    std::string passwordSet;
+    for( int i = 0; i < CC_COUNT; ++i )
+        passwordSet.append( charClassSets[i] );
+
+    results.clear();
+    failed = false;
+
+    struct timespec start, end;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    testAlphabet( "passwords", STE_PASSWORD, SELFTEST_PASSWORD_LENGTH, passwordSet );
+    testAlphabet( "PINs", STE_PIN, SELFTEST_PIN_LENGTH, "0123456789" );
+    testAlphabet( "hex keys", STE_HEX, SELFTEST_HEX_BYTES * 2, "0123456789abcdef" );
+    testNames();
+    testLiterals();
+
+    for( size_t i = 0; i < results.size(); ++i )
+        fprintf( out, "%-48s %-26s p = %-10.4g %s\n", results[i].name.c_str(), results[i].statistic.c_str(),
+                 results[i].p, ( results[i].p < SELFTEST_FAIL_P ) ? "FAILED" : "ok" );
+
+    clock_gettime( CLOCK_MONOTONIC, &end );
+
+    fprintf( out, "%lld samples per test in %.1f s, %s\n", samples,
+             ( end.tv_sec - start.tv_sec ) + ( end.tv_nsec - start.tv_nsec ) * 1e-9, failed ? "FAILED" : "passed" );
+
+    return !failed;
+}
+
+
+template<class Work, class State>
+bool SelfTest::runChunks( long long items, Work work, std::vector<State> *states )
+{
+    const long long chunkCount = ( items + SELFTEST_CHUNK_ITEMS - 1 ) / SELFTEST_CHUNK_ITEMS;
+    std::atomic<long long> nextChunk( 0 );
+    std::atomic<bool> ok( true );
+    std::vector<std::thread> workers;
+
+    for( int t = 0; t < threads; ++t )
+    {
+        workers.push_back( std::thread( [&, t]()
+        {
+            long long index;
+
+            while( ok && ( index = nextChunk++ ) < chunkCount )
+            {
+                // Seeded mode gives every chunk its own stream, not every thread the same one
+                Randomizer::selectStream( index + 1 );
+
+                if( !work( std::min( (long long)SELFTEST_CHUNK_ITEMS, items - index * SELFTEST_CHUNK_ITEMS ),
+                           &(*states)[t] ) )
+                    ok = false;
+            }
+        } ) );
+    }
+
+    for( size_t i = 0; i < workers.size(); ++i )
+        workers[i].join();
+
+    return ok;
+}
+
+
+void SelfTest::testAlphabet( const char *name, int entity, int length, const std::string &alphabet )
+{
+    const int size = alphabet.size();
+    int8_t map[256];
+
+    memset( map, -1, sizeof(map) );
+    for( int i = 0; i < size; ++i )
+        map[(uint8_t)alphabet[i]] = i;
+
+    std::vector<Symbols> states( threads );
+    for( int t = 0; t < threads; ++t )
+        states[t].counts.assign( length * ( size + 1 ), 0 );
+
+    // Fixed-length items sit every stride bytes of a chunk
+    const size_t stride = length + 1;
+
+    const bool generated = runChunks( samples, [&]( long long items, Symbols *state )
+    {
+        std::vector<char> chunk( items * stride );
+        std::vector<uint32_t> offsets( items + 1 );
+        size_t made = 0;
+
+        switch( entity )
+        {
+            case STE_PASSWORD: made = Randomizer::makePasswords( &chunk[0], stride, length, items ); break;
+            case STE_PIN:      made = Randomizer::makePins( &chunk[0], stride, length, items );      break;
+            case STE_HEX:
+                    made = Randomizer::makeKeys( &chunk[0], chunk.size(), &offsets[0], '\n', length / 2, KE_HEX, items );
+                break;
+        }
+
+        for( size_t i = 0; i < made; ++i )
+            state->add( &chunk[i * stride], length, size, map );
+
+        return (long long)made == items;
+    }, &states );
+
+    for( int t = 1; t < threads; ++t )
+        states[0].merge( states[t] );
+
+    const Symbols &total = states[0];
+    const std::string prefix = std::string( name ) + " of " + std::to_string( length ) + " chars, ";
+
+    if( !generated )
+        addResult( prefix + "generation", "generator failed", 0 );
+
+    // Every symbol of every position is equally likely
+    std::vector<double> expected( size + 1, (double)samples / size );
+    std::vector<uint64_t> pooled( size + 1, 0 );
+    double worstP = 1;
+    int worstPosition = 0;
+
+    expected[size] = 0;
+
+    for( int i = 0; i < length; ++i )
+    {
+        const uint64_t *counts = &total.counts[i * ( size + 1 )];
+        double chiSquare = 0;
+
+        for( int j = 0; j <= size; ++j )
+        {
+            pooled[j] += counts[j];
+            chiSquare += ( j < size ) ? ( counts[j] - expected[j] ) * ( counts[j] - expected[j] ) / expected[j]
+                                      : ( counts[j] > 0 ? INFINITY : 0 );
+        }
+
+        const double p = chiSquareP( chiSquare, size - 1 );
+        if( p < worstP )
+        {
+            worstP = p;
+            worstPosition = i;
+        }
+    }
+
+    // The worst of <length> positions is that bad more often
+    addResult( prefix + "worst position frequency", "position " + std::to_string( worstPosition ),
+               std::min( 1.0, worstP * length ) );
+
+    for( int j = 0; j < size; ++j )
+        expected[j] *= length;
+
+    addChiSquare( prefix + "overall frequency", &pooled[0], &expected[0], size + 1 );
+
+    // Knuth's serial correlation coefficient, close to normal with deviation 1 / sqrt( n )
+    const long double n = total.n;
+    const long double sum = total.sum;
+    const long double denominator = n * total.sumSquares - sum * sum;
+    const double r = ( denominator > 0 ) ? (double)( ( n * total.sumProducts - sum * sum ) / denominator ) : 1;
+    const double z = r * sqrt( (double)n );
+
+    char statistic[64];
+    snprintf( statistic, sizeof(statistic), "r = %.3g", r );
+    addResult( prefix + "serial correlation", statistic, erfc( fabs( z ) / sqrt( 2.0 ) ) );
+}
+
+
+void SelfTest::testNames()
+{
+    const int letters = 26;
+
+    std::vector<std::vector<uint64_t> > states( threads, std::vector<uint64_t>( letters + 1, 0 ) );
+
+    const bool generated = runChunks( samples, [&]( long long items, std::vector<uint64_t> *counts )
+    {
+        std::vector<char> chunk( items * ( NAME_MAX_LENGTH( 5 ) + 1 ) );
+        std::vector<uint32_t> offsets( items + 1 );
+
+        const size_t made = Randomizer::makeNames( &chunk[0], chunk.size(), &offsets[0], '\n',
+                                                   SELFTEST_NAME_SYLLABLES, items );
+
+        for( size_t i = 0; i < made; ++i )
+        {
+            const int letter = chunk[offsets[i]] - 'a';
+            (*counts)[( letter >= 0 && letter < letters ) ? letter : letters]++;
+        }
+
+        return (long long)made == items;
+    }, &states );
+
+    for( int t = 1; t < threads; ++t )
+        for( int j = 0; j <= letters; ++j )
+            states[0][j] += states[t][j];
+
+    if( !generated )
+        addResult( "names, generation", "generator failed", 0 );
+
+    /*
+     * The first consonant is left out in 4 of 16 cases, or may be the empty
+     * one, then the name starts with a vowel. Duplicates come later.
+     */
+    const double unit = 1 << ALIAS_WEIGHT_BITS;
+    double emptyConsonant = 0;
+
+    for( size_t i = 0; i < Randomizer::literalCount( NLS_CONSONANTS ); ++i )
+        if( Randomizer::literalValue( NLS_CONSONANTS, i )[0] == '\0' )
+            emptyConsonant += Randomizer::literalWeight( NLS_CONSONANTS, i ) / unit;
+
+    std::vector<double> expected( letters + 1, 0 );
+
+    for( size_t i = 0; i < Randomizer::literalCount( NLS_VOWELS ); ++i )
+        expected[Randomizer::literalValue( NLS_VOWELS, i )[0] - 'a'] +=
+            ( 4.0 / 16 + 12.0 / 16 * emptyConsonant ) * Randomizer::literalWeight( NLS_VOWELS, i ) / unit * samples;
+
+    for( size_t i = 0; i < Randomizer::literalCount( NLS_CONSONANTS ); ++i )
+    {
+        const char first = Randomizer::literalValue( NLS_CONSONANTS, i )[0];
+        if( first != '\0' )
+            expected[first - 'a'] += 12.0 / 16 * Randomizer::literalWeight( NLS_CONSONANTS, i ) / unit * samples;
+    }
+
+    addChiSquare( "names, first letter against LitInfo weights", &states[0][0], &expected[0], letters + 1 );
+}
+
+
+void SelfTest::testLiterals()
+{
+    static const char *names[NLS_COUNT] = { "vowel", "consonant", "word end" };
+
+    for( int set = 0; set < NLS_COUNT; ++set )
+    {
+        const size_t count = Randomizer::literalCount( (NameLiteralSet)set );
+        std::vector<std::vector<uint64_t> > states( threads, std::vector<uint64_t>( count, 0 ) );
+
+        const bool generated = runChunks( samples, [&]( long long items, std::vector<uint64_t> *counts )
+        {
+            return Randomizer::countLiterals( (NameLiteralSet)set, &(*counts)[0], items );
+        }, &states );
+
+        std::vector<double> expected( count );
+        for( size_t i = 0; i < count; ++i )
+        {
+            expected[i] = (double)Randomizer::literalWeight( (NameLiteralSet)set, i ) / ( 1 << ALIAS_WEIGHT_BITS ) * samples;
+
+            for( int t = 1; t < threads; ++t )
+                states[0][i] += states[t][i];
+        }
+
+        const std::string name = std::string( names[set] ) + " literals against LitInfo weights";
+
+        if( generated )
+            addChiSquare( name, &states[0][0], &expected[0], count );
+        else
+            addResult( name, "generator failed", 0 );
+    }
+}
+
+
+void SelfTest::addChiSquare( const std::string &name, const uint64_t *counts, const double *expected, size_t cells )
+{
+    double chiSquare = 0;
+    int df = -1;
+
+    // Cells expecting nothing must stay empty
+    for( size_t i = 0; i < cells; ++i )
+    {
+        if( expected[i] > 0 )
+        {
+            chiSquare += ( counts[i] - expected[i] ) * ( counts[i] - expected[i] ) / expected[i];
+            df++;
+        }
+        else if( counts[i] > 0 )
+        {
+            chiSquare = INFINITY;
+        }
+    }
+
+    char statistic[64];
+    snprintf( statistic, sizeof(statistic), "chi2 = %.1f, df = %d", chiSquare, df );
+    addResult( name, statistic, chiSquareP( chiSquare, df ) );
+}
+
+
+void SelfTest::addResult( const std::string &name, const std::string &statistic, double p )
+{
+    const Result result = { name, statistic, p };
+    results.push_back( result );
+
+    if( p < SELFTEST_FAIL_P )
+        failed = true;
+}
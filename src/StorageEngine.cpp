@@ -179,6 +179,16 @@ bool DataRow::operator < ( const DataRow &other ) const
 }
 
 
+bool DataRow::operator == ( const DataRow &other ) const
+{
+    for( int i = 0; i < DATA_COLS_COUNT; ++i )
+        if( cells[i] != other.cells[i] )
+            return false;
+
+    return true;
+}
+
+
 StorageEngine::StorageEngine( const QString &file )
 : dbFileName( file )
 {
@@ -0,0 +1,250 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "UniqueFilter.h"
+
+#include <math.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <algorithm>
+
+#define UNIQUE_INDEX_MIN_SLOTS  1024
+
+
+static inline uint64_t mix( uint64_t x )
+{
+    // MurmurHash3 finalizer
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+
+    return x;
+}
+
+
+static uint64_t hashItem( const char *item, size_t length )
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ length;
+    size_t i = 0;
+
+    for( ; i + 8 <= length; i += 8 )
+    {
+        uint64_t word;
+        memcpy( &word, item + i, sizeof(word) );
+        hash = mix( hash ^ word );
+    }
+
+    uint64_t tail = 0;
+    memcpy( &tail, item + i, length - i );
+
+    return mix( hash ^ tail ^ ( (uint64_t)( length - i ) << 56 ) );
+}
+
+
+UniqueFilter::UniqueFilter( long long plannedItems )
+: indexUsed( 0 )
+, accepted( 0 )
+, rejected( 0 )
+, filterHits( 0 )
+{
+    const uint64_t wantedBits = (uint64_t)std::max( 1LL, plannedItems ) * UNIQUE_FILTER_ITEM_BITS;
+    uint64_t bits = 1 << 16;
+
+    while( bits < wantedBits && bits < (uint64_t)UNIQUE_FILTER_MAX_BYTES * 8 )
+        bits <<= 1;
+
+    bloom.assign( bits / 64, 0 );
+    bloomMask = bits - 1;
+
+    index.assign( UNIQUE_INDEX_MIN_SLOTS, 0 );
+    tags.assign( UNIQUE_INDEX_MIN_SLOTS, 0 );
+}
+
+
+UniqueFilter::~UniqueFilter()
+{
+    // The arena holds generated secrets
+    if( !arena.empty() )
+        OPENSSL_cleanse( &arena[0], arena.size() );
+}
+
+
+bool UniqueFilter::insert( const char *item, size_t length )
+{
+    const uint64_t hash = hashItem( item, length );
+    const uint64_t step = mix( hash ) | 1;
+    bool allSet = true;
+
+    // Double hashing, h1 + i * h2, for the Bloom probes
+    for( int i = 0; i < UNIQUE_FILTER_HASHES; ++i )
+    {
+        const uint64_t bit = ( hash + i * step ) & bloomMask;
+        uint64_t &word = bloom[bit / 64];
+        const uint64_t mask = (uint64_t)1 << ( bit % 64 );
+
+        allSet = allSet && ( word & mask );
+        word |= mask;
+    }
+
+    if( allSet )
+    {
+        ++filterHits;
+
+        if( findExact( hash, item, length ) )
+        {
+            ++rejected;
+            return false;
+        }
+    }
+
+    addExact( hash, item, length );
+    ++accepted;
+
+    return true;
+}
+
+
+double UniqueFilter::effectiveEntropyBits( bool *isLowerBound ) const
+{
+    const double draws = accepted + rejected;
+    const double unique = accepted;
+
+    *isLowerBound = ( 0 == rejected );
+
+    if( draws < 2 )
+        return 0.0;
+
+    // No repeats: fewer than one expected, draws**2 / 2N < 1
+    if( 0 == rejected )
+        return log2( draws * draws / 2 );
+
+    /*
+     * Distinct values after n uniform draws from N are expected to be
+     * N * ( 1 - exp( -n / N ) ), increasing in N: bisect log2( N ).
+     */
+    double low = log2( unique ), high = 256.0;
+
+    for( int i = 0; i < 100; ++i )
+    {
+        const double middle = ( low + high ) / 2;
+        const double space = exp2( middle );
+
+        if( -space * expm1( -draws / space ) < unique )
+            low = middle;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+
+bool UniqueFilter::findExact( uint64_t hash, const char *item, size_t length ) const
+{
+    const size_t mask = index.size() - 1;
+    const uint32_t tag = (uint32_t)( hash >> 32 );
+
+    for( size_t slot = hash & mask; 0 != index[slot]; slot = ( slot + 1 ) & mask )
+    {
+        if( tags[slot] != tag )
+            continue;
+
+        const char *stored = arena.data() + index[slot] - 1;
+        uint32_t storedLength;
+        memcpy( &storedLength, stored, sizeof(storedLength) );
+
+        if( storedLength == length && memcmp( stored + sizeof(storedLength), item, length ) == 0 )
+            return true;
+    }
+
+    return false;
+}
+
+
+void UniqueFilter::addExact( uint64_t hash, const char *item, size_t length )
+{
+    // Half-full index at most, so probe runs stay short
+    if( ( indexUsed + 1 ) * 2 > index.size() )
+        growIndex();
+
+    const size_t mask = index.size() - 1;
+    size_t slot = hash & mask;
+
+    while( 0 != index[slot] )
+        slot = ( slot + 1 ) & mask;
+
+    const uint32_t storedLength = length;
+
+    index[slot] = arena.size() + 1;
+    tags[slot] = (uint32_t)( hash >> 32 );
+    ++indexUsed;
+
+    // Grown by hand, so the released copy can be wiped
+    if( arena.size() + sizeof(storedLength) + length > arena.capacity() )
+    {
+        std::vector<char> bigger;
+        bigger.reserve( std::max( arena.capacity() * 2, arena.size() + sizeof(storedLength) + length + 4096 ) );
+        bigger.assign( arena.begin(), arena.end() );
+
+        if( !arena.empty() )
+            OPENSSL_cleanse( &arena[0], arena.size() );
+
+        arena.swap( bigger );
+    }
+
+    arena.insert( arena.end(), (const char*)&storedLength, (const char*)&storedLength + sizeof(storedLength) );
+    arena.insert( arena.end(), item, item + length );
+}
+
+
+void UniqueFilter::growIndex()
+{
+    std::vector<uint64_t> oldIndex( index.size() * 2, 0 );
+    std::vector<uint32_t> oldTags( tags.size() * 2, 0 );
+
+    oldIndex.swap( index );
+    oldTags.swap( tags );
+
+    const size_t mask = index.size() - 1;
+
+    for( size_t i = 0; i < oldIndex.size(); ++i )
+    {
+        if( 0 == oldIndex[i] )
+            continue;
+
+        // Slot depends on the full hash, take it again from the stored item
+        const char *stored = arena.data() + oldIndex[i] - 1;
+        uint32_t storedLength;
+        memcpy( &storedLength, stored, sizeof(storedLength) );
+
+        size_t slot = hashItem( stored + sizeof(storedLength), storedLength ) & mask;
+        while( 0 != index[slot] )
+            slot = ( slot + 1 ) & mask;
+
+        index[slot] = oldIndex[i];
+        tags[slot] = oldTags[i];
+    }
+}
@@ -0,0 +1,155 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "Wordlist.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <limits>
+
+
+Wordlist::Wordlist()
+: data( NULL )
+, dataSize( 0 )
+, longest( 0 )
+{
+}
+
+
+Wordlist::~Wordlist()
+{
+    if( NULL != data )
+        munmap( (void*)data, dataSize );
+}
+
+
+Wordlist *Wordlist::open( const char *path )
+{
+    const int fd = ::open( path, O_RDONLY | O_CLOEXEC );
+    if( fd < 0 )
+        return NULL;
+
+    struct stat info;
+    if( fstat( fd, &info ) != 0 )
+    {
+        const int error = errno;
+        close( fd );
+        errno = error;
+        return NULL;
+    }
+
+    if( 0 == info.st_size || (uint64_t)info.st_size > std::numeric_limits<uint32_t>::max() )
+    {
+        close( fd );
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void *mapping = mmap( NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    const int error = errno;
+    close( fd );
+
+    if( MAP_FAILED == mapping )
+    {
+        errno = error;
+        return NULL;
+    }
+
+    Wordlist *list = new Wordlist();
+    list->data = (const char*)mapping;
+    list->dataSize = info.st_size;
+
+    if( !list->index() )
+    {
+        delete list;
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return list;
+}
+
+
+double Wordlist::entropyBits( int wordCount ) const
+{
+    return wordCount * log2( (double)words.size() );
+}
+
+
+bool Wordlist::index()
+{
+    // A single sequential pass, words are referenced in place
+    madvise( (void*)data, dataSize, MADV_SEQUENTIAL );
+
+    const char *end = data + dataSize;
+
+    for( const char *line = data; line < end; )
+    {
+        const char *lineEnd = (const char*)memchr( line, '\n', end - line );
+        if( NULL == lineEnd )
+            lineEnd = end;
+
+        const char *word = line;
+        const char *wordEnd = lineEnd;
+
+        // Dice digits of the EFF format
+        while( word < wordEnd && *word >= '1' && *word <= '6' )
+            ++word;
+
+        if( word == wordEnd || ( *word != '\t' && *word != ' ' ) )
+            word = line;
+
+        while( word < wordEnd && ( *word == '\t' || *word == ' ' ) )
+            ++word;
+
+        while( wordEnd > word && ( wordEnd[-1] == '\r' || wordEnd[-1] == ' ' || wordEnd[-1] == '\t' ) )
+            --wordEnd;
+
+        if( wordEnd - word > WORDLIST_MAX_WORD )
+            return false;
+
+        if( wordEnd > word )
+        {
+            WordRef ref;
+            ref.offset = word - data;
+            ref.length = wordEnd - word;
+
+            words.push_back( ref );
+            if( ref.length > longest )
+                longest = ref.length;
+        }
+
+        line = lineEnd + 1;
+    }
+
+    madvise( (void*)data, dataSize, MADV_RANDOM );
+
+    // Indices are drawn with Randomizer::makeNumber()
+    return !words.empty() && words.size() <= std::numeric_limits<uint32_t>::max();
+}
@@ -23,106 +23,908 @@
  */
 
 #include "Randomizer.h"
+#include "RawStream.h"
+#include "SelfTest.h"
+#include "EntropySource.h"
+#include "BulkGenerator.h"
+#include "KeyEncoder.h"
+#include "KeyedPermutation.h"
+#include "UniqueFilter.h"
+#include "NameModel.h"
+#include "PasswordPolicy.h"
+#include "SecretServer.h"
 
+#include <errno.h>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <algorithm>
+#include <string>
+#include <vector>
 
 
-enum RandomEntity { RE_UNKNOWN, RE_NAME, RE_PIN, RE_PASSWD, RE_BYTES };
-
-typedef std::string (*RandomFn)(int);
+#define BENCH_SECONDS       0.5
+#define BENCH_CALLS_BATCH   16
+#define BENCH_BITS_BATCH    (1 << 20)
+#define BENCH_ITEMS_COUNT   (1 << 21)
+#define BENCH_ENCODE_BYTES  (1 << 16)
+#define BENCH_SERVE_REQUESTS 10000
+#define BENCH_PIPELINE_DEPTH 64
+#define BENCH_SPAWN_COUNT   1000
 
 
 static void help( const char *programName )
 {
-    printf( "Usage: %s <number> <\"nicknames\"/\"PINs\"/\"passwords\"/\"bytes\"> [length]\n"
+    printf( "Usage: %s [options] <number> <\"nicknames\"/\"PINs\"/\"passwords\"/\"bytes\"/\"passphrases\"> [length]\n"
             "\tProgram will output <number> of following entities:\n"
-            "\t\tnicknames: random-generated words of [length(default = 2-5)] syllables\n"
+            "\t\tnicknames: random-generated words of [length(default = 2-5)] syllables,\n"
+            "\t\t\tor of [length(default = 5-10)] letters with -m\n"
             "\t\tPINs: PIN-codes of [length(default = 4)] digits\n"
             "\t\tpasswords: random string of [length(default = 12)] chars from 64 possible\n"
-            "\t\tbytes: HEX presentation of [length(default = 16)] random bytes\n"
+            "\t\tbytes: [length(default = 16)] random bytes as text, HEX unless -e is given\n"
+            "\t\tpassphrases: [length(default = 6)] words of the -w list joined with '-'\n"
             "\tLength can be specified as a single decimal or a range, e.g. \"5-10\"\n\n"
-            "\tExample:\n\t\t%s 16 passwords 11\n\n",
-            programName, programName );
+            "\tExample:\n\t\t%s 16 passwords 11\n\n"
+            "Usage: %s [options] bench\n"
+            "\tMeasure throughput of every entropy backend, cost of random bit requests\n"
+            "\tand random bits spent per PIN and per range draw\n\n"
+            "Usage: %s [options] selftest [samples(default = %lld)]\n"
+            "\tStatistical tests of passwords, PINs, hex keys and names, in -j threads\n\n"
+            "Usage: %s [options] raw <size>[K/M/G] [file]\n"
+            "\tWrite <size> raw random bytes to [file] or to stdout, filled by -j threads\n\n"
+            "Usage: %s train <corpus> <model> [order(default = 3)]\n"
+            "\tBuild a nickname model for -m from every run of letters of <corpus>\n\n"
+            "Usage: %s [options] serve <socket>\n"
+            "\tAnswer lines \"<number> <entity> [length]\" on a Unix socket with \"OK <number>\"\n"
+            "\tand the items, from buffers refilled ahead; -e, -p, -m and -w apply to all requests\n\n"
+            "Usage: %s bench-serve <socket> [requests(default = %d)]\n"
+            "\tLatency and throughput of \"serve\" at <socket>, against a process per password\n\n"
+            "Options:\n"
+            "\t-b <backend>\tEntropy source: \"openssl\" (default), \"getrandom\" or \"chacha20\"\n"
+            "\t-e <encoding>\tBytes encoding: \"hex\" (default), \"base64\", \"base64url\", \"base32\" or \"base58\"\n"
+            "\t-p <policy>\tPassword rules: preset \"web\", \"alnum\" or \"strong\", or char classes\n"
+            "\t\t\tu(pper), l(ower), d(igit), s(ymbol) with minimal counts, as \"u1l1d2s\".\n"
+            "\t\t\tForbidden chars may follow a colon: \"u1l1d1s1:#?\"\n"
+            "\t-m <model>\tNicknames from a letter model made by \"train\"\n"
+            "\t-w <file>\tWord list for passphrases, EFF large list format or a word per line\n"
+            "\t-j <threads>\tGenerate in <threads> worker threads with buffered output\n"
+            "\t-u\t\tWith -j: write chunks as soon as they are ready, not in generation order\n"
+            "\t--unique\tDrop repeats while generating, report collision rate and effective entropy.\n"
+            "\t\t\tFixed length PINs and keys up to %d bytes walk a random permutation instead\n"
+            "\t--stats\t\tReport random bits drawn and the entropy of the output\n"
+            "\t--seed <text>\tTEST ONLY: reproducible output derived from <text>, not secret at all\n\n",
+            programName, programName, programName, programName, SELFTEST_DEFAULT_SAMPLES, programName, programName,
+            programName, programName, BENCH_SERVE_REQUESTS, PERMUTATION_MAX_BYTES );
+}
+
+
+static double elapsedSeconds( const struct timespec &start )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ( now.tv_sec - start.tv_sec ) + ( now.tv_nsec - start.tv_nsec ) * 1e-9;
 }
 
 
-static RandomEntity identifyCommand( const char *cmd )
+static void printStats( const GenerationJob &job, const BulkGenerator &generator, long long written )
 {
-    std::string command( cmd );
-    std::transform( command.begin(), command.end(), command.begin(), (int(*)(int))tolower );
+    OutputEntropy entropy;
+
+    switch( job.entity )
+    {
+        case RE_PIN:    entropy = Randomizer::pinEntropy( job.minLength, job.maxLength ); break;
+        case RE_BYTES:  entropy = Randomizer::keyEntropy( job.minLength, job.maxLength ); break;
+        case RE_PHRASE: entropy = Randomizer::passphraseEntropy( *job.wordlist, job.minLength, job.maxLength ); break;
+
+        case RE_PASSWD:
+                entropy = ( NULL != job.policy ) ? Randomizer::passwordEntropy( *job.policy )
+                                                 : Randomizer::passwordEntropy( job.minLength, job.maxLength );
+            break;
+
+        case RE_NAME:
+                entropy = ( NULL != job.nameModel ) ? Randomizer::nameEntropy( *job.nameModel, job.minLength, job.maxLength )
+                                                    : Randomizer::nameEntropy( job.minLength, job.maxLength );
+            break;
+
+        default:
+            return;
+    }
+
+    fprintf( stderr, "Random bits drawn: %llu, %.2f per item\n"
+                     "Output entropy: %s%.2f bits Shannon, %s%.2f bits min-entropy\n",
+             (unsigned long long)generator.bitsDrawn(), ( written > 0 ) ? (double)generator.bitsDrawn() / written : 0.0,
+             entropy.exact ? "" : "at most ", entropy.shannonBits, entropy.exact ? "" : "at most ", entropy.minBits );
+
+    if( RE_NAME == job.entity )
+        fprintf( stderr, "Mean information of the written names: %.2f bits\n", generator.meanInformation() );
+}
+
+
+static int benchmarkBackends()
+{
+    static const size_t chunkSizes[] = { 32, RANDOM_BUFFER_SIZE, 1 << 20 };
+    const size_t chunkCount = sizeof(chunkSizes) / sizeof(chunkSizes[0]);
+
+    std::vector<uint8_t> chunk( chunkSizes[chunkCount - 1] );
+
+    printf( "%-10s %10s %12s %14s\n", "backend", "chunk", "MB/s", "calls/s" );
+
+    for( int backend = 0; backend < EB_COUNT; ++backend )
+    {
+        const char *name = EntropySource::backendName( (EntropyBackend)backend );
+        EntropySource *source = EntropySource::create( (EntropyBackend)backend );
+
+        for( size_t i = 0; i < chunkCount; ++i )
+        {
+            unsigned long long calls = 0;
+            double elapsed;
+
+            struct timespec start;
+            clock_gettime( CLOCK_MONOTONIC, &start );
+
+            do
+            {
+                for( int j = 0; j < BENCH_CALLS_BATCH; ++j )
+                    if( !source->fill( &chunk[0], chunkSizes[i] ) )
+                    {
+                        fprintf( stderr, "Backend %s failed\n", name );
+                        delete source;
+                        return 1;
+                    }
+
+                calls += BENCH_CALLS_BATCH;
+                elapsed = elapsedSeconds( start );
+            }
+            while( elapsed < BENCH_SECONDS );
+
+            printf( "%-10s %10zu %12.1f %14.0f\n", name, chunkSizes[i],
+                    calls * chunkSizes[i] / elapsed / 1e6, calls / elapsed );
+        }
+
+        delete source;
+    }
+
+    return 0;
+}
+
+
+static int benchmarkBits()
+{
+    // Request sizes of the name, password, hex and literal generators
+    static const int bitCounts[] = { 1, 4, 6, 8, 24 };
+
+    printf( "\n%-10s %12s\n", "bits", "ns/call" );
+
+    for( size_t i = 0; i < sizeof(bitCounts) / sizeof(bitCounts[0]); ++i )
+    {
+        unsigned long long calls = 0;
+        double elapsed;
+
+        struct timespec start;
+        clock_gettime( CLOCK_MONOTONIC, &start );
+
+        do
+        {
+            for( int j = 0; j < BENCH_BITS_BATCH; ++j )
+                Randomizer::makeBits( bitCounts[i] );
+
+            calls += BENCH_BITS_BATCH;
+            elapsed = elapsedSeconds( start );
+        }
+        while( elapsed < BENCH_SECONDS );
+
+        printf( "%-10d %12.2f\n", bitCounts[i], elapsed * 1e9 / calls );
+    }
+
+    return 0;
+}
+
+
+static int benchmarkUniform()
+{
+    // PIN lengths cover the whole-group, 2-digit and 1-digit tails; ranges go from cheap to the worst rejection rate
+    static const int pinLengths[] = { 4, 6, 8 };
+    static const uint32_t ranges[] = { 10, 62, 1000, 10000, 0x80000001U };
+
+    printf( "\n%-14s %12s %12s %12s\n", "draw", "ns/call", "bits/call", "min bits" );
+
+    for( size_t i = 0; i < sizeof(pinLengths) / sizeof(pinLengths[0]); ++i )
+    {
+        unsigned long long calls = 0;
+        const uint64_t bitsBefore = Randomizer::bitsDrawn();
+        double elapsed;
+
+        struct timespec start;
+        clock_gettime( CLOCK_MONOTONIC, &start );
+
+        do
+        {
+            for( int j = 0; j < BENCH_BITS_BATCH; ++j )
+                Randomizer::makePin( pinLengths[i] );
+
+            calls += BENCH_BITS_BATCH;
+            elapsed = elapsedSeconds( start );
+        }
+        while( elapsed < BENCH_SECONDS );
+
+        char label[32];
+        snprintf( label, sizeof(label), "PIN %d", pinLengths[i] );
+
+        printf( "%-14s %12.2f %12.2f %12.2f\n", label, elapsed * 1e9 / calls,
+                (double)( Randomizer::bitsDrawn() - bitsBefore ) / calls, pinLengths[i] * log2( 10.0 ) );
+    }
+
+    for( size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]); ++i )
+    {
+        unsigned long long calls = 0;
+        const uint64_t bitsBefore = Randomizer::bitsDrawn();
+        double elapsed;
+
+        struct timespec start;
+        clock_gettime( CLOCK_MONOTONIC, &start );
+
+        do
+        {
+            for( int j = 0; j < BENCH_BITS_BATCH; ++j )
+                Randomizer::makeNumber( ranges[i] );
+
+            calls += BENCH_BITS_BATCH;
+            elapsed = elapsedSeconds( start );
+        }
+        while( elapsed < BENCH_SECONDS );
+
+        char label[32];
+        snprintf( label, sizeof(label), "[0, %u)", ranges[i] );
+
+        printf( "%-14s %12.2f %12.2f %12.2f\n", label, elapsed * 1e9 / calls,
+                (double)( Randomizer::bitsDrawn() - bitsBefore ) / calls, log2( (double)ranges[i] ) );
+    }
+
+    return 0;
+}
+
+
+static int benchmarkGeneration()
+{
+    const GenerationJob job = { RE_PASSWD, BENCH_ITEMS_COUNT, 12, 12, KE_HEX };
+    const int threadCount = std::max( 1L, sysconf( _SC_NPROCESSORS_ONLN ) );
+
+    FILE *nullFile = fopen( "/dev/null", "w" );
+    if( NULL == nullFile )
+    {
+        perror( "/dev/null" );
+        return 1;
+    }
+
+    printf( "\n%-10s %10s %14s\n", "mode", "threads", "passwords/s" );
+
+    for( int mode = 0; mode < 4; ++mode )
+    {
+        BulkGenerator generator( job );
+        const int threads = ( mode < 2 ) ? 1 : threadCount;
+        bool ok;
+
+        struct timespec start;
+        clock_gettime( CLOCK_MONOTONIC, &start );
+
+        if( 0 == mode )
+            ok = generator.writeSerial( nullFile );
+        else
+            ok = generator.writeParallel( fileno( nullFile ), threads, mode != 3 );
+
+        const double elapsed = elapsedSeconds( start );
+
+        if( !ok )
+        {
+            fprintf( stderr, "Generation failed\n" );
+            fclose( nullFile );
+            return 1;
+        }
+
+        static const char *modeNames[] = { "serial", "ordered", "ordered", "unordered" };
+        printf( "%-10s %10d %14.0f\n", modeNames[mode], threads, job.count / elapsed );
+    }
+
+    fclose( nullFile );
+    return 0;
+}
+
+
+static int benchmarkEncoders()
+{
+    // 256-bit keys, input throughput is comparable with the backend table
+    const size_t keyBytes = 32;
+    std::vector<uint8_t> keys( BENCH_ENCODE_BYTES );
+    std::vector<char> text( KeyEncoder::encodedLength( KE_BASE58, keyBytes ) );
+
+    for( size_t i = 0; i < keys.size(); ++i )
+        keys[i] = (uint8_t)( i * 2654435761U >> 13 );
+
+    printf( "\n%-10s %12s\n", "encoding", "MB/s" );
+
+    for( int encoding = 0; encoding < KE_COUNT; ++encoding )
+    {
+        unsigned long long bytes = 0;
+        double elapsed;
+
+        struct timespec start;
+        clock_gettime( CLOCK_MONOTONIC, &start );
+
+        do
+        {
+            for( size_t i = 0; i + keyBytes <= keys.size(); i += keyBytes )
+                KeyEncoder::encode( (KeyEncoding)encoding, &text[0], &keys[i], keyBytes );
+
+            bytes += keys.size() / keyBytes * keyBytes;
+            elapsed = elapsedSeconds( start );
+        }
+        while( elapsed < BENCH_SECONDS );
+
+        printf( "%-10s %12.1f\n", KeyEncoder::encodingName( (KeyEncoding)encoding ), bytes / elapsed / 1e6 );
+    }
+
+    return 0;
+}
+
+
+// Takes one reply off the front of pending, reading more from fd as needed
+static bool readReply( int fd, std::string *pending )
+{
+    for( ;; )
+    {
+        const size_t header = pending->find( '\n' );
+        if( header != std::string::npos )
+        {
+            long long count;
+            if( sscanf( pending->c_str(), "OK %lld", &count ) != 1 )
+            {
+                fprintf( stderr, "Server: %s", pending->substr( 0, header + 1 ).c_str() );
+                return false;
+            }
+
+            size_t end = header + 1, next;
+            for( ; count > 0 && ( next = pending->find( '\n', end ) ) != std::string::npos; --count )
+                end = next + 1;
+
+            if( 0 == count )
+            {
+                pending->erase( 0, end );
+                return true;
+            }
+        }
+
+        char buffer[1 << 16];
+        const ssize_t received = read( fd, buffer, sizeof(buffer) );
+        if( received <= 0 )
+        {
+            fprintf( stderr, "Server closed the connection\n" );
+            return false;
+        }
+
+        pending->append( buffer, received );
+    }
+}
+
+
+static void printLatency( const char *name, std::vector<double> *latencies, double elapsed )
+{
+    std::sort( latencies->begin(), latencies->end() );
+
+    const size_t count = latencies->size();
+    printf( "%-12s %10zu %12.1f %12.1f %12.1f %14.0f\n", name, count, elapsed / count * 1e6,
+            (*latencies)[count / 2] * 1e6, (*latencies)[count * 99 / 100] * 1e6, count / elapsed );
+}
+
+
+// Secrets from a "serve" socket against a process per secret
+static int benchmarkServer( const char *path, long long requests )
+{
+    static const char request[] = "1 passwords\n";
+    const long long spawns = std::min( requests, (long long)BENCH_SPAWN_COUNT );
+
+    struct sockaddr_un address;
+    memset( &address, 0, sizeof(address) );
+    address.sun_family = AF_UNIX;
+    strncpy( address.sun_path, path, sizeof(address.sun_path) - 1 );
+
+    const int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if( fd < 0 || connect( fd, (struct sockaddr*)&address, sizeof(address) ) != 0 )
+    {
+        perror( path );
+        if( fd >= 0 )
+            close( fd );
+        return 1;
+    }
+
+    std::string pending;
+    std::vector<double> latencies;
+    latencies.reserve( requests );
+
+    printf( "%-12s %10s %12s %12s %12s %14s\n", "mode", "requests", "mean us", "median us", "99% us", "requests/s" );
+
+    // A request at a time, the full round trip
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    for( long long i = 0; i < requests; ++i )
+    {
+        struct timespec sent;
+        clock_gettime( CLOCK_MONOTONIC, &sent );
+
+        if( !RawStream::writeAll( fd, request, sizeof(request) - 1 ) || !readReply( fd, &pending ) )
+        {
+            close( fd );
+            return 1;
+        }
 
-    if( command.find( "name" ) != std::string::npos ) return RE_NAME;
-    if( command.find( "pin" ) != std::string::npos )  return RE_PIN;
-    if( command.find( "pass" ) != std::string::npos ) return RE_PASSWD;
-    if( command.find( "byte" ) != std::string::npos ) return RE_BYTES;
+        latencies.push_back( elapsedSeconds( sent ) );
+    }
+
+    printLatency( "sequential", &latencies, elapsedSeconds( start ) );
+
+    // BENCH_PIPELINE_DEPTH requests in one write, latency is of the whole batch
+    std::string batch;
+    for( int i = 0; i < BENCH_PIPELINE_DEPTH; ++i )
+        batch.append( request );
+
+    latencies.clear();
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    for( long long i = 0; i < requests; i += BENCH_PIPELINE_DEPTH )
+    {
+        struct timespec sent;
+        clock_gettime( CLOCK_MONOTONIC, &sent );
+
+        const int depth = (int)std::min( requests - i, (long long)BENCH_PIPELINE_DEPTH );
+        bool ok = RawStream::writeAll( fd, batch.data(), depth * ( sizeof(request) - 1 ) );
+
+        for( int j = 0; ok && j < depth; ++j )
+            ok = readReply( fd, &pending );
+
+        if( !ok )
+        {
+            close( fd );
+            return 1;
+        }
+
+        const double elapsed = elapsedSeconds( sent );
+        for( int j = 0; j < depth; ++j )
+            latencies.push_back( elapsed );
+    }
+
+    printLatency( "pipelined", &latencies, elapsedSeconds( start ) );
+    close( fd );
+
+    // What the pipelines did before: a process per secret
+    char *const arguments[] = { (char*)"ds_randomgen", (char*)"1", (char*)"passwords", NULL };
+    latencies.clear();
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    for( long long i = 0; i < spawns; ++i )
+    {
+        struct timespec sent;
+        clock_gettime( CLOCK_MONOTONIC, &sent );
+
+        int output[2];
+        if( pipe2( output, O_CLOEXEC ) != 0 )
+        {
+            perror( "pipe" );
+            return 1;
+        }
 
-    return RE_UNKNOWN;
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init( &actions );
+        posix_spawn_file_actions_adddup2( &actions, output[1], STDOUT_FILENO );
+
+        pid_t child;
+        const int error = posix_spawn( &child, "/proc/self/exe", &actions, NULL, arguments, environ );
+        posix_spawn_file_actions_destroy( &actions );
+        close( output[1] );
+
+        if( 0 != error )
+        {
+            close( output[0] );
+            fprintf( stderr, "Spawn failed: %s\n", strerror( error ) );
+            return 1;
+        }
+
+        char buffer[256];
+        while( read( output[0], buffer, sizeof(buffer) ) > 0 )
+            ;
+
+        close( output[0] );
+        waitpid( child, NULL, 0 );
+        latencies.push_back( elapsedSeconds( sent ) );
+    }
+
+    printLatency( "fork/exec", &latencies, elapsedSeconds( start ) );
+    return 0;
 }
 
 
 int main( int argc, char **argv )
 {
-    if( 3 != argc && 4 != argc )
+    const char *programName = argv[0];
+    EntropyBackend backend;
+    KeyEncoding encoding = KE_HEX;
+    PasswordPolicy policy = { 0, 0, CC_ALL, { 0, 0, 0, 0 }, NULL };
+    bool havePolicy = false;
+    const char *wordlistPath = NULL;
+    const char *modelPath = NULL;
+    bool unique = false;
+    bool stats = false;
+    const char *seed = NULL;
+    int threadCount = 0;
+    bool ordered = true;
+    int option;
+
+    static const struct option longOptions[] = {
+        { "unique", no_argument, NULL, 'U' },
+        { "seed", required_argument, NULL, 'S' },
+        { "stats", no_argument, NULL, 'T' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    while( ( option = getopt_long( argc, argv, "b:e:j:m:p:uw:", longOptions, NULL ) ) != -1 )
     {
-        help( argv[0] );
+        switch( option )
+        {
+            case 'b':
+                    if( !EntropySource::parseBackend( optarg, &backend ) || !Randomizer::setBackend( backend ) )
+                    {
+                        fprintf( stderr, "Unknown entropy backend: %s\n", optarg );
+                        return 1;
+                    }
+                break;
+
+            case 'e':
+                    if( !KeyEncoder::parseEncoding( optarg, &encoding ) )
+                    {
+                        fprintf( stderr, "Unknown encoding: %s\n", optarg );
+                        return 1;
+                    }
+                break;
+
+            case 'm':
+                    modelPath = optarg;
+                break;
+
+            case 'p':
+                    if( !PasswordPolicy::parse( optarg, &policy ) )
+                    {
+                        fprintf( stderr, "Invalid password policy: %s\n", optarg );
+                        return 1;
+                    }
+
+                    havePolicy = true;
+                break;
+
+            case 'j':
+                    if( sscanf( optarg, "%d", &threadCount ) != 1 || threadCount < 1 )
+                    {
+                        fprintf( stderr, "Invalid thread count: %s\n", optarg );
+                        return 1;
+                    }
+                break;
+
+            case 'u':
+                    ordered = false;
+                break;
+
+            case 'w':
+                    wordlistPath = optarg;
+                break;
+
+            case 'U':
+                    unique = true;
+                break;
+
+            case 'S':
+                    seed = optarg;
+                break;
+
+            case 'T':
+                    stats = true;
+                break;
+
+            default:
+                    help( programName );
+                    return 1;
+        }
+    }
+
+    // After -b, so the seed wins over any backend
+    if( NULL != seed )
+    {
+        Randomizer::setSeed( seed, strlen( seed ) );
+        fprintf( stderr, "DETERMINISTIC MODE: output is reproducible from the seed, do not use it as secrets\n" );
+    }
+
+    // Positional arguments
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if( 2 == argc && strcmp( argv[1], "bench" ) == 0 )
+        return benchmarkBackends() || benchmarkBits() || benchmarkUniform() || benchmarkGeneration() || benchmarkEncoders();
+
+    if( ( 2 == argc || 3 == argc ) && strcmp( argv[1], "selftest" ) == 0 )
+    {
+        long long samples = SELFTEST_DEFAULT_SAMPLES;
+        if( 3 == argc && ( sscanf( argv[2], "%lld", &samples ) != 1 || samples < 1 ) )
+        {
+            fprintf( stderr, "Invalid sample count: %s\n", argv[2] );
+            return 1;
+        }
+
+        SelfTest test( samples, threadCount );
+        return test.run( stdout ) ? 0 : 1;
+    }
+
+    if( ( 3 == argc || 4 == argc ) && strcmp( argv[1], "raw" ) == 0 )
+    {
+        unsigned long long size;
+        char unit = '\0';
+
+        // A missing unit is the zero terminator found by strchr()
+        if( sscanf( argv[2], "%llu%c", &size, &unit ) < 1 || NULL == strchr( "kKmMgG", unit ) )
+        {
+            fprintf( stderr, "Invalid size: %s\n", argv[2] );
+            return 1;
+        }
+
+        switch( unit )
+        {
+            case 'g': case 'G': size <<= 10;  // Fall through
+            case 'm': case 'M': size <<= 10;  // Fall through
+            case 'k': case 'K': size <<= 10;
+            default:            break;
+        }
+
+        // Key material, so a new file is readable by the owner only
+        const int fd = ( 4 == argc ) ? open( argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0600 ) : STDOUT_FILENO;
+        if( fd < 0 )
+        {
+            perror( argv[3] );
+            return 1;
+        }
+
+        const bool ok = RawStream::write( fd, size, threadCount );
+        if( !ok )
+            perror( "Raw output" );
+
+        if( STDOUT_FILENO != fd && close( fd ) != 0 )
+            return 1;
+
+        return ok ? 0 : 1;
+    }
+
+    if( ( 4 == argc || 5 == argc ) && strcmp( argv[1], "train" ) == 0 )
+    {
+        int order = NAME_MODEL_MAX_ORDER;
+        if( 5 == argc && ( sscanf( argv[4], "%d", &order ) != 1 || order < 1 || order > NAME_MODEL_MAX_ORDER ) )
+        {
+            fprintf( stderr, "Model order must be 1 to %d\n", NAME_MODEL_MAX_ORDER );
+            return 1;
+        }
+
+        if( !NameModel::train( argv[2], argv[3], order ) )
+        {
+            perror( "Training failed" );
+            return 1;
+        }
+
         return 0;
     }
 
-    int count;
-    RandomEntity entity = identifyCommand( argv[2] );
-    RandomFn randImpl = NULL;
-    int minLength, maxLength;
+    if( 3 == argc && strcmp( argv[1], "serve" ) == 0 )
+    {
+        if( Randomizer::isSeeded() )
+        {
+            fprintf( stderr, "Seeded output cannot be served\n" );
+            return 1;
+        }
+
+        GenerationJob defaults;
+        memset( &defaults, 0, sizeof(defaults) );
+        defaults.encoding = encoding;
+
+        if( NULL != wordlistPath && NULL == ( defaults.wordlist = Wordlist::open( wordlistPath ) ) )
+        {
+            perror( wordlistPath );
+            return 1;
+        }
 
-    switch( entity )
+        if( NULL != modelPath && NULL == ( defaults.nameModel = NameModel::open( modelPath ) ) )
+        {
+            perror( modelPath );
+            delete defaults.wordlist;
+            return 1;
+        }
+
+        SecretServer server( defaults, havePolicy ? &policy : NULL );
+        fprintf( stderr, "Serving on %s\n", argv[2] );
+
+        const bool ok = server.serve( argv[2] );
+        if( !ok )
+            perror( argv[2] );
+
+        delete defaults.wordlist;
+        delete defaults.nameModel;
+        return ok ? 0 : 1;
+    }
+
+    if( ( 3 == argc || 4 == argc ) && strcmp( argv[1], "bench-serve" ) == 0 )
     {
-        case RE_NAME:
-                minLength = 2;
-                maxLength = 5;
-            break;
+        long long requests = BENCH_SERVE_REQUESTS;
+        if( 4 == argc && ( sscanf( argv[3], "%lld", &requests ) != 1 || requests < 1 ) )
+        {
+            fprintf( stderr, "Invalid request count: %s\n", argv[3] );
+            return 1;
+        }
 
-        case RE_PIN:
-                minLength = maxLength = 4;
-                randImpl = &Randomizer::makePin;
-            break;
+        return benchmarkServer( argv[2], requests );
+    }
 
-        case RE_PASSWD:
-                minLength = maxLength = 12;
-                randImpl = &Randomizer::makePassword;
-            break;
+    if( 3 != argc && 4 != argc )
+    {
+        help( programName );
+        return 0;
+    }
 
-        case RE_BYTES:
-                minLength = maxLength = 16;
-                randImpl = &Randomizer::makeHexBlock;
-            break;
+    GenerationJob job;
+    job.entity = BulkGenerator::parseEntity( argv[2] );
+    job.encoding = encoding;
 
-        default:
-                help( argv[0] );
-                return 1;
+    if( !BulkGenerator::defaultLengths( job.entity, NULL != modelPath, &job.minLength, &job.maxLength ) )
+    {
+        help( programName );
+        return 1;
     }
 
-    sscanf( argv[1], "%d", &count );
+    if( sscanf( argv[1], "%lld", &job.count ) != 1 || job.count < 0 )
+        job.count = 0;
 
     if( argc > 3 )
     {
-        if( sscanf( argv[3], "%d-%d", &minLength, &maxLength ) == 1 )
-            maxLength = minLength;
+        if( sscanf( argv[3], "%d-%d", &job.minLength, &job.maxLength ) == 1 )
+            job.maxLength = job.minLength;
+    }
+
+    // Length argument overrides the one of a preset
+    if( havePolicy && ( argc > 3 || 0 == policy.minLength ) )
+    {
+        policy.minLength = job.minLength;
+        policy.maxLength = job.maxLength;
+    }
+
+    const PolicyTable policyTable( policy );
+    job.policy = NULL;
+
+    if( havePolicy && RE_PASSWD == job.entity )
+    {
+        if( policy.maxLength > POLICY_MAX_LENGTH )
+        {
+            fprintf( stderr, "Passwords with a policy are at most %d chars long\n", POLICY_MAX_LENGTH );
+            return 1;
+        }
+
+        if( !policyTable.isValid() )
+        {
+            fprintf( stderr, "Password policy cannot be satisfied\n" );
+            return 1;
+        }
+
+        job.policy = &policyTable;
     }
 
-    for( int i = 0; i < count; ++i )
-        if( RE_NAME == entity )
+    job.wordlist = NULL;
+    job.nameModel = NULL;
+
+    if( RE_NAME == job.entity && NULL != modelPath )
+    {
+        job.nameModel = NameModel::open( modelPath );
+        if( NULL == job.nameModel )
         {
-            puts( Randomizer::makeName( minLength, maxLength ).c_str() );
+            perror( modelPath );
+            return 1;
         }
-        else if( NULL != randImpl )
+    }
+
+    if( RE_PHRASE == job.entity )
+    {
+        if( NULL == wordlistPath )
+        {
+            fprintf( stderr, "Passphrases need a word list, see -w\n" );
+            return 1;
+        }
+
+        job.wordlist = Wordlist::open( wordlistPath );
+        if( NULL == job.wordlist )
         {
-            int curLength = minLength;
+            perror( wordlistPath );
+            return 1;
+        }
+
+        // Output is for the pipe, strength is for the operator
+        fprintf( stderr, "Passphrase strength: %.1f", job.wordlist->entropyBits( job.minLength ) );
+        if( job.maxLength > job.minLength )
+            fprintf( stderr, "-%.1f", job.wordlist->entropyBits( job.maxLength ) );
+        fprintf( stderr, " bits, %zu words in the list\n", job.wordlist->size() );
+    }
+
+    // Fixed domains are enumerated in a random order, nothing to filter
+    const bool permuted = unique && job.minLength == job.maxLength &&
+        ( ( RE_PIN == job.entity && job.minLength <= PERMUTATION_MAX_DIGITS ) ||
+          ( RE_BYTES == job.entity && job.minLength <= PERMUTATION_MAX_BYTES ) );
 
-            if( curLength < maxLength )
-                curLength += Randomizer::makeNumber( maxLength - curLength + 1 );
+    KeyedPermutation *permutation = NULL;
+    job.permutation = NULL;
 
-            puts( randImpl( curLength ).c_str() );
+    if( permuted && job.minLength > 0 )
+    {
+        const uint64_t maxValue = ( RE_PIN == job.entity ) ? KeyedPermutation::pinMaxValue( job.minLength )
+                                                           : KeyedPermutation::keyMaxValue( job.minLength );
+
+        if( job.count > 0 && (uint64_t)job.count - 1 > maxValue )
+        {
+            fprintf( stderr, "Only %llu distinct items of this length exist\n", (unsigned long long)maxValue + 1 );
+            return 1;
         }
 
-    return 0;
+        permutation = KeyedPermutation::create( maxValue );
+        if( NULL == permutation )
+        {
+            perror( "Permutation key" );
+            return 1;
+        }
+
+        job.permutation = permutation;
+    }
+
+    UniqueFilter *filter = ( unique && !permuted ) ? new UniqueFilter( job.count ) : NULL;
+    job.unique = filter;
+    job.measure = stats;
+
+    BulkGenerator generator( job );
+    bool ok;
+
+    if( threadCount > 0 )
+        ok = generator.writeParallel( STDOUT_FILENO, threadCount, ordered );
+    else
+        ok = generator.writeSerial( stdout );
+
+    if( stats )
+        printStats( job, generator, ( NULL != filter ) ? filter->acceptedCount() : job.count );
+
+    if( NULL != filter )
+    {
+        const long long drawn = filter->acceptedCount() + filter->rejectedCount();
+        bool lowerBound;
+        const double entropy = filter->effectiveEntropyBits( &lowerBound );
+
+        if( generator.isSaturated() )
+            fprintf( stderr, "Output space used up after %lld unique items\n", filter->acceptedCount() );
+
+        fprintf( stderr, "Unique: %lld of %lld drawn, %lld repeats (%.4f%%), %lld filter hits\n"
+                         "Effective entropy: %s%.1f bits\n",
+                 filter->acceptedCount(), drawn, filter->rejectedCount(),
+                 ( drawn > 0 ) ? 100.0 * filter->rejectedCount() / drawn : 0.0, filter->filterHitCount(),
+                 lowerBound ? "over " : "", entropy );
+
+        delete filter;
+    }
+
+    delete permutation;
+    delete job.wordlist;
+    delete job.nameModel;
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,331 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Pavel Ognev
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "Randomizer.h"
+#include "EntropySource.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+
+#define TEST_NEAR_START      128                           // Every reservoir offset, twice
+#define TEST_BUFFER_EDGE     ( RANDOM_BUFFER_SIZE * 8 )    // First bit of the second buffer
+#define TEST_LONG_RUN_BITS   ( 3 * RANDOM_BUFFER_SIZE * 8 + 123 )
+
+
+// Byte i of the test stream, the same in every process
+static uint8_t streamByte( uint64_t i )
+{
+    uint64_t z = ( i + 1 ) * 0x9E3779B97F4A7C15ULL;
+    z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+    z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+
+    return (uint8_t)( z >> 56 );
+}
+
+
+// Bits [first, first + count) of the stream, each byte LSB first
+static uint32_t streamBits( uint64_t first, int count )
+{
+    uint32_t bits = 0;
+
+    for( int i = 0; i < count; ++i )
+        bits |= (uint32_t)( ( streamByte( ( first + i ) / 8 ) >> ( ( first + i ) % 8 ) ) & 1 ) << i;
+
+    return bits;
+}
+
+
+// Hands out the test stream from its first byte, whatever the fill sizes
+class FixedSource : public EntropySource
+{
+public:
+    FixedSource() : position( 0 ) {}
+
+    bool fill( uint8_t *dst, size_t size )
+    {
+        for( size_t i = 0; i < size; ++i )
+            dst[i] = streamByte( position++ );
+
+        return true;
+    }
+
+    uint64_t position;
+
+};
+
+
+/*
+ * Bit accounting of Randomizer::getBits(): every request width at every
+ * reservoir offset, near the start and across a buffer refill, gets
+ * exactly the next bits of the stream, and no bit taken from the source
+ * is skipped. Also unreadReservoir() and the state left after fork(),
+ * for seeded sources too.
+ */
+class RandomizerTest
+{
+public:
+    RandomizerTest() : checks( 0 ), failures( 0 ) {}
+
+    bool run();
+
+private:
+    Randomizer *create( FixedSource **source );
+    bool skip( Randomizer *randomizer, uint64_t bits );
+    void check( bool ok, const char *format, ... );
+
+    void testWidths( uint64_t first );
+    void testLongRun();
+    void testUnread();
+    void testFork();
+    void testSeededFork();
+
+private:
+    long long checks;
+    long long failures;
+
+};
+
+
+bool RandomizerTest::run()
+{
+    for( uint64_t first = 0; first < TEST_NEAR_START; ++first )
+        testWidths( first );
+
+    for( uint64_t first = TEST_BUFFER_EDGE - 64; first < TEST_BUFFER_EDGE + 64; ++first )
+        testWidths( first );
+
+    testLongRun();
+    testUnread();
+    testFork();
+    testSeededFork();
+
+    printf( "%lld checks, %lld failed\n", checks, failures );
+    return 0 == failures;
+}
+
+
+Randomizer *RandomizerTest::create( FixedSource **source )
+{
+    Randomizer *randomizer = new Randomizer();
+
+    *source = new FixedSource();
+    delete randomizer->source;
+    randomizer->source = *source;
+
+    return randomizer;
+}
+
+
+// Draws bits in the widest requests, so the reservoir ends at any offset
+bool RandomizerTest::skip( Randomizer *randomizer, uint64_t bits )
+{
+    uint32_t value;
+
+    for( ; bits > 0; bits -= std::min( bits, (uint64_t)32 ) )
+        if( !randomizer->getBits( &value, (int)std::min( bits, (uint64_t)32 ) ) )
+            return false;
+
+    return true;
+}
+
+
+void RandomizerTest::check( bool ok, const char *format, ... )
+{
+    checks++;
+    if( ok )
+        return;
+
+    failures++;
+
+    va_list args;
+    va_start( args, format );
+    fprintf( stderr, "FAILED: " );
+    vfprintf( stderr, format, args );
+    fprintf( stderr, "\n" );
+    va_end( args );
+}
+
+
+void RandomizerTest::testWidths( uint64_t first )
+{
+    for( int width = 1; width <= 32; ++width )
+    {
+        FixedSource *source;
+        Randomizer *randomizer = create( &source );
+        uint32_t value, next;
+
+        const bool ok = skip( randomizer, first ) && randomizer->getBits( &value, width ) && randomizer->getBits( &next, 32 );
+
+        check( ok && value == streamBits( first, width ), "%d bits at bit %llu", width, (unsigned long long)first );
+        check( ok && next == streamBits( first + width, 32 ), "32 bits after %d at bit %llu", width, (unsigned long long)first );
+        check( randomizer->drawnBits == first + width + 32, "drawn bits count after %d at bit %llu", width, (unsigned long long)first );
+
+        delete randomizer;
+    }
+}
+
+
+void RandomizerTest::testLongRun()
+{
+    FixedSource *source;
+    Randomizer *randomizer = create( &source );
+    uint64_t position = 0;
+
+    for( int i = 0; position < TEST_LONG_RUN_BITS; ++i )
+    {
+        const int width = 1 + i * 7 % 32;
+        uint32_t value;
+
+        if( !randomizer->getBits( &value, width ) || value != streamBits( position, width ) )
+        {
+            check( false, "long run: %d bits at bit %llu", width, (unsigned long long)position );
+            break;
+        }
+
+        position += width;
+
+        // Taken from the source = handed out + still in the reservoir + still buffered
+        const uint64_t unread = ( RANDOM_BUFFER_SIZE - randomizer->bufferUsed ) * 8 + randomizer->reservoirBits;
+        if( source->position * 8 != position + unread )
+        {
+            check( false, "long run: bits wasted at bit %llu", (unsigned long long)position );
+            break;
+        }
+    }
+
+    check( position >= TEST_LONG_RUN_BITS, "long run reached the end" );
+    delete randomizer;
+}
+
+
+void RandomizerTest::testUnread()
+{
+    FixedSource *source;
+    Randomizer *randomizer = create( &source );
+    uint32_t value;
+    uint8_t bytes[3];
+
+    // 56 bits left, whole bytes: put back into the buffer
+    randomizer->getBits( &value, 8 );
+    check( randomizer->unreadReservoir() && 0 == randomizer->reservoirBits, "unread 56 bits" );
+
+    randomizer->getBytes( bytes, sizeof(bytes) );
+    check( bytes[0] == streamByte( 1 ) && bytes[1] == streamByte( 2 ) && bytes[2] == streamByte( 3 ), "bytes after unread" );
+
+    // 59 bits left, not whole bytes: kept in the reservoir
+    randomizer->getBits( &value, 5 );
+    check( value == streamBits( 32, 5 ), "bits after bytes" );
+    check( !randomizer->unreadReservoir() && 59 == randomizer->reservoirBits, "unaligned reservoir kept" );
+
+    randomizer->getBits( &value, 3 );
+    check( value == streamBits( 37, 3 ), "bits after a refused unread" );
+    check( randomizer->unreadReservoir(), "unread 56 bits again" );
+
+    randomizer->getBytes( bytes, 1 );
+    check( bytes[0] == streamByte( 5 ), "byte after the second unread" );
+
+    delete randomizer;
+}
+
+
+void RandomizerTest::testFork()
+{
+    // Child exits with 0 if it got fresh source bytes
+    for( int mode = 0; mode < 3; ++mode )
+    {
+        FixedSource *source;
+        Randomizer *randomizer = create( &source );
+        uint32_t value;
+
+        // Buffer holds the rest of the first 4 KiB, the reservoir 56 bits of it
+        randomizer->getBits( &value, 8 );
+
+        fflush( stdout );
+        const pid_t child = fork();
+        if( 0 == child )
+        {
+            uint8_t byte;
+
+            // Whatever the first request is, it must not see the parent's bytes
+            switch( mode )
+            {
+                case 0:
+                    _exit( randomizer->getBits( &value, 32 ) && value == streamBits( TEST_BUFFER_EDGE, 32 ) ? 0 : 1 );
+
+                case 1:
+                    _exit( randomizer->getBytes( &byte, 1 ) && byte == streamByte( RANDOM_BUFFER_SIZE ) ? 0 : 1 );
+
+                default:
+                    _exit( !randomizer->unreadReservoir() ? 0 : 1 );
+            }
+        }
+
+        int status = -1;
+        check( child > 0 && waitpid( child, &status, 0 ) == child && WIFEXITED( status ) && 0 == WEXITSTATUS( status ),
+               "fresh bytes in a forked child, request %d", mode );
+
+        // The parent goes on where it was
+        check( randomizer->getBits( &value, 32 ) && value == streamBits( 8, 32 ), "parent bits after fork, request %d", mode );
+
+        delete randomizer;
+    }
+}
+
+
+void RandomizerTest::testSeededFork()
+{
+    uint8_t key[SEED_KEY_SIZE] = { 1 };
+    uint8_t parentBytes[16], childBytes[16];
+    EntropySource *source = EntropySource::createSeeded( key, 7 );
+
+    fflush( stdout );
+    const pid_t child = fork();
+    if( 0 == child )
+    {
+        // The inherited stream must not repeat the parent's next bytes, a new one works
+        EntropySource *fresh = EntropySource::createSeeded( key, 7 );
+        const bool ok = !source->fill( childBytes, sizeof(childBytes) ) && ECHILD == errno &&
+                        fresh->fill( childBytes, sizeof(childBytes) );
+        _exit( ok ? 0 : 1 );
+    }
+
+    int status = -1;
+    check( child > 0 && waitpid( child, &status, 0 ) == child && WIFEXITED( status ) && 0 == WEXITSTATUS( status ),
+           "seeded source in a forked child" );
+
+    check( source->fill( parentBytes, sizeof(parentBytes) ), "parent seeded source after fork" );
+
+    delete source;
+}
+
+
+int main()
+{
+    RandomizerTest test;
+    return test.run() ? 0 : 1;
+}